@@ -29,9 +29,13 @@
  * @author Joan Duran <joan.duran@uib.es>
  */
 
+#include <algorithm>
+
 #include "libdemosaic.h"
 #include "assert.h"
 
+#undef DUMP_STAGES // write the locally interpolated image to demosaicked.tiff
+
 /**
  * \brief Fill in missing green values at each pixel by local directional
  *        interpolation.
@@ -63,6 +67,7 @@ void g_directional (
   // CFA mask
   unsigned char *cfamask = new unsigned char[dim];
 
+#pragma omp parallel for
   for (int x = 0; x < width; x++) {
     for (int y = 0; y < height; y++) {
       int l = y * width + x;
@@ -82,6 +87,7 @@ void g_directional (
   // Bilinear interpolation of Green at boundaries
   // Average of four neighbouring green pixels taking a mirror symmetry
   // at the boundaries
+#pragma omp parallel for
   for (int x = 0; x < width; x++) {
     for (int y = 0; y < height; y++) {
       int l = y * width + x;
@@ -119,13 +125,13 @@ void g_directional (
   }
 
   // Directional interpolation of Green inside image
-  float *color;
-
+#pragma omp parallel for
   for (int x = 3; x < width - 3; x++) {
     for (int y = 3; y < height - 3; y++) {
       int l = y * width + x;
 
       if (cfamask[l] != GREENPOSITION) {
+        float *color;
         if (cfamask[l] == REDPOSITION)
           color = red;
         else
@@ -186,6 +192,7 @@ void rb_bilinear (
   // CFA mask
   unsigned char *cfamask = new unsigned char[dim];
 
+#pragma omp parallel for
   for (int x = 0; x < width; x++) {
     for (int y = 0; y < height; y++) {
       int l = y * width + x;
@@ -200,6 +207,7 @@ void rb_bilinear (
   }
 
   // Compute difference channels
+#pragma omp parallel for
   for (int i = 0; i < dim; i++) {
     red[i] -= beta * green[i];
     blue[i] -= beta * green[i];
@@ -207,6 +215,7 @@ void rb_bilinear (
 
   // Interpolate blue making the average of neihbouring blue pixels
   // Take a mirror symmetry at boundaries
+#pragma omp parallel for
   for (int x = 0; x < width; x++) {
     for (int y = 0; y < height; y++) {
       int l = y * width + x;
@@ -244,6 +253,7 @@ void rb_bilinear (
 
   // Interpolate red making the average of neihbouring red pixels
   // Take a mirror symmetry at boundaries
+#pragma omp parallel for
   for (int x = 0; x < width; x++) {
     for (int y = 0; y < height; y++) {
       int l = y * width + x;
@@ -280,6 +290,7 @@ void rb_bilinear (
   }
 
   // Make back differences
+#pragma omp parallel for
   for (int i = 0; i < dim; i++) {
     red[i] += beta * green[i];
     blue[i] += beta * green[i];
@@ -305,6 +316,21 @@ void rb_bilinear (
  * \brief Compute the variation of the chromatic components U and V along
  *        one direction (north, south, east, or west).
  *
+ * The variation at a pixel is the root mean square difference between the
+ * pixel and the samples s of its window along the direction, samples off
+ * the image (or on its first row or column) counting as zero differences:
+ *
+ *   sum (u[s] - u0)^2 = S2 - 2 d0 S1 + n d0^2
+ *
+ * with S1, S2 the sums of d = u[s] - m and its square over the n valid
+ * samples, and d0 = u0 - m. The sums are differences of prefix sums, so
+ * the cost does not depend on halfL. The prefix sums are kept in double
+ * and restarted, with a new reference sample m, every VARIATION_BLOCK
+ * pixels along the direction, so that small variations are not lost in
+ * the cancellation. North and south are done across columns, a strip of
+ * VARIATION_STRIP columns at a time, east and west along rows,
+ * VARIATION_ROWS rows at a time, so that the scans vectorize across them.
+ *
  * @param[out] u, v  variation of chromatic components U and V from the YUV
  *             space at each pixel: the pointer accounts for the pixel position.
  * @param[in]  direction  direction along which the variation of the chromatic
@@ -323,95 +349,161 @@ void variation4d (
   // Support size when computing variance
   int support = 2 * halfL + 1;
 
-  // Compute variation of chromatic components along selected direction
-  if (direction == NORTH) {
-    for (int y = 0; y < height; y++) {
-      for (int x = 0; x < width; x++) {
-        float sum = 0.0f;
-        float value0 = u[y * width + x];
-
-        for (int i = -support; i <= 0; i++) {
-          int s = y + i;
-
-          float value = 0.0f;
-
-          if ((s > 0) && (s < height))
-            value = u[s * width + x] - value0;
+  // Window lo .. hi along the direction, relative to the pixel
+  int lo = (direction == NORTH || direction == WEST) ? -support : 0;
+  int hi = lo + support;
+
+  // Prefix sums of a block and its window margins
+  int plen = VARIATION_BLOCK + support + 1;
+
+  if (direction == NORTH || direction == SOUTH) {
+    int nblocks = (height + VARIATION_BLOCK - 1) / VARIATION_BLOCK;
+    int nstrips = (width + VARIATION_STRIP - 1) / VARIATION_STRIP;
+
+#pragma omp parallel
+    {
+      double *p1 = new double[plen * VARIATION_STRIP];
+      double *p2 = new double[plen * VARIATION_STRIP];
+
+#pragma omp for collapse(2) schedule(dynamic)
+      for (int b = 0; b < nblocks; b++) {
+        for (int st = 0; st < nstrips; st++) {
+          int y0 = b * VARIATION_BLOCK, y1 = MIN(y0 + VARIATION_BLOCK, height);
+          int x0 = st * VARIATION_STRIP, x1 = MIN(x0 + VARIATION_STRIP, width);
+          int sw = x1 - x0;
+          int base = y0 + lo;
+          const float *m = u + y0 * width + x0;
+
+          // p[k] sums the rows base .. base + k - 1
+          for (int x = 0; x < sw; x++)
+            p1[x] = p2[x] = 0.0;
+
+          for (int k = 0, s = base; s < y1 + hi; k++, s++) {
+            double *q1 = p1 + k * sw, *q2 = p2 + k * sw;
+            double *r1 = q1 + sw, *r2 = q2 + sw;
+
+            if ((s > 0) && (s < height)) {
+              const float *us = u + s * width + x0;
+              for (int x = 0; x < sw; x++) {
+                double d = us[x] - m[x];
+                r1[x] = q1[x] + d;
+                r2[x] = q2[x] + d * d;
+              }
+            }
+            else {
+              for (int x = 0; x < sw; x++) {
+                r1[x] = q1[x];
+                r2[x] = q2[x];
+              }
+            }
+          }
 
-          sum += value * value;
+          for (int y = y0; y < y1; y++) {
+            int n = MAX(0, MIN(y + hi, height - 1) - MAX(y + lo, 1) + 1);
+            const double *a1 = p1 + (y + lo - base) * sw, *a2 = p2 + (y + lo - base) * sw;
+            const double *b1 = p1 + (y + hi - base + 1) * sw, *b2 = p2 + (y + hi - base + 1) * sw;
+            const float *u0 = u + y * width + x0;
+            float *out = v + y * width + x0;
+
+            for (int x = 0; x < sw; x++) {
+              double d0 = u0[x] - m[x];
+              double sum = (b2[x] - a2[x]) - 2.0 * d0 * (b1[x] - a1[x]) + n * d0 * d0;
+              out[x] = sqrtf(MAX(sum, 0.0) / (float) support);
+            }
+          }
         }
-
-        v[y * width + x] = sqrtf(sum / (float) support);
       }
-    }
-
-  }
-  else if (direction == SOUTH) {
-    for (int y = 0; y < height; y++) {
-      for (int x = 0; x < width; x++) {
-        float sum = 0.0f;
-        float value0 = u[y * width + x];
-
-        for (int i = 0; i <= support; i++) {
-          int s = y + i;
 
-          float value = 0.0f;
-
-          if ((s > 0) && (s < height))
-            value = u[s * width + x] - value0;
-
-          sum += value * value;
-        }
-
-        v[y * width + x] = sqrtf(sum / (float) support);
-      }
+      delete[] p1;
+      delete[] p2;
     }
-
   }
-  else if (direction == WEST) {
-    for (int y = 0; y < height; y++)
-      for (int x = 0; x < width; x++) {
-        float sum = 0.0f;
-        int l0 = y * width;
-        float value0 = u[l0 + x];
-
-        for (int i = -support; i <= 0; i++) {
-          int s = x + i;
-
-          float value = 0.0f;
+  else {
+    int nblocks = (width + VARIATION_BLOCK - 1) / VARIATION_BLOCK;
+
+#pragma omp parallel
+    {
+      double *p1 = new double[plen * VARIATION_ROWS];
+      double *p2 = new double[plen * VARIATION_ROWS];
+
+#pragma omp for schedule(dynamic)
+      for (int y0 = 0; y0 < height; y0 += VARIATION_ROWS) {
+        int nr = MIN(VARIATION_ROWS, height - y0);
+        const float *rows = u + y0 * width;
+
+        for (int b = 0; b < nblocks; b++) {
+          int x0 = b * VARIATION_BLOCK, x1 = MIN(x0 + VARIATION_BLOCK, width);
+          int base = x0 + lo;
+          float m[VARIATION_ROWS];
+          for (int r = 0; r < nr; r++)
+            m[r] = rows[r * width + x0];
+
+          // p[k * nr + r] sums the columns base .. base + k - 1 of row r
+          for (int r = 0; r < nr; r++)
+            p1[r] = p2[r] = 0.0;
+
+          for (int k = 0, s = base; s < x1 + hi; k++, s++) {
+            double *q1 = p1 + k * nr, *q2 = p2 + k * nr;
+            double *r1 = q1 + nr, *r2 = q2 + nr;
+
+            if ((s > 0) && (s < width)) {
+              for (int r = 0; r < nr; r++) {
+                double d = rows[r * width + s] - m[r];
+                r1[r] = q1[r] + d;
+                r2[r] = q2[r] + d * d;
+              }
+            }
+            else {
+              for (int r = 0; r < nr; r++) {
+                r1[r] = q1[r];
+                r2[r] = q2[r];
+              }
+            }
+          }
 
-          if ((s > 0) && (s < width))
-            value = u[l0 + s] - value0;
+          for (int x = x0; x < x1; x++) {
+            int n = MAX(0, MIN(x + hi, width - 1) - MAX(x + lo, 1) + 1);
+            const double *a1 = p1 + (x + lo - base) * nr, *a2 = p2 + (x + lo - base) * nr;
+            const double *b1 = p1 + (x + hi - base + 1) * nr, *b2 = p2 + (x + hi - base + 1) * nr;
 
-          sum += value * value;
+            for (int r = 0; r < nr; r++) {
+              double d0 = rows[r * width + x] - m[r];
+              double sum = (b2[r] - a2[r]) - 2.0 * d0 * (b1[r] - a1[r]) + n * d0 * d0;
+              v[(y0 + r) * width + x] = sqrtf(MAX(sum, 0.0) / (float) support);
+            }
+          }
         }
-
-        v[l0 + x] = sqrtf(sum / (float) support);
       }
 
+      delete[] p1;
+      delete[] p2;
+    }
   }
-  else {
-    for (int y = 0; y < height; y++) {
-      for (int x = 0; x < width; x++) {
-        float sum = 0.0f;
-        int l0 = y * width;
-        float value0 = u[l0 + x];
-
-        for (int i = 0; i <= support; i++) {
-          int s = x + i;
+}
 
-          float value = 0.0f;
+/**
+ * \brief Interpolate all three channels locally in one direction.
+ *
+ * @param[in]  red, green, blue  mosaicked red, green, and blue channels.
+ * @param[out] ored, ogreen, oblue  full channels, green interpolated along
+ *             direction and red and blue bilinearly.
+ *
+ */
 
-          if (s > 0 && s < width)
-            value = u[l0 + s] - value0;
+static void directional_interpolation (
+  float *red, float *green, float *blue,
+  float *ored, float *ogreen, float *oblue,
+  float beta, int direction,
+  int redx, int redy, int width, int height
+) {
+  int dim = width * height;
 
-          sum += value * value;
-        }
+  wxCopy(red, ored, dim);
+  wxCopy(green, ogreen, dim);
+  wxCopy(blue, oblue, dim);
 
-        v[l0 + x] = sqrtf(sum / (float) support);
-      }
-    }
-  }
+  g_directional(ored, ogreen, oblue, beta, direction, redx, redy, width, height);
+  rb_bilinear(ored, ogreen, oblue, beta, redx, redy, width, height);
 }
 
 /**
@@ -443,153 +535,67 @@ void local_algorithm (
   // Initializations
   int dim = width * height;
 
-  // YUV vectors
-  float *y = new float[dim];
+  // The directions are blended in this order
+  const int directions[4] = {NORTH, SOUTH, WEST, EAST};
+
+  // Interpolated image in the current direction, its chromatic components
+  // and their variation
+  float *ar = new float[dim];
+  float *ag = new float[dim];
+  float *ab = new float[dim];
   float *u = new float[dim];
   float *v = new float[dim];
+  float *uTv = new float[dim];
 
-  // Interpolation in the north direction
-  float *arn = new float[dim];
-  float *agn = new float[dim];
-  float *abn = new float[dim];
-
-  fpCopy(red, arn, dim);
-  fpCopy(green, agn, dim);
-  fpCopy(blue, abn, dim);
-
-  g_directional(arn, agn, abn, beta, NORTH, redx, redy, width, height);
-  rb_bilinear(arn, agn, abn, beta, redx, redy, width, height);
-
-  // Convert interpolated image into YUV space
-  fiRgb2Yuv(arn, agn, abn, y, u, v, dim);
-
-  // Compute variation of chormatic components
-  float *northuTv = new float[dim];
-  float *northvTv = new float[dim];
-
-  variation4d(u, northuTv, NORTH, halfL, width, height);
-  variation4d(v, northvTv, NORTH, halfL, width, height);
-
-  for (int i = 0; i < dim; i++)
-    northuTv[i] += northvTv[i];
-
-  // Interpolation in the south direction
-  float *ars = new float[dim];
-  float *ags = new float[dim];
-  float *abs = new float[dim];
-
-  fpCopy(red, ars, dim);
-  fpCopy(green, ags, dim);
-  fpCopy(blue, abs, dim);
-
-  g_directional(ars, ags, abs, beta, SOUTH, redx, redy, width, height);
-  rb_bilinear(ars, ags, abs, beta, redx, redy, width, height);
-
-  // Convert interpolated image into YUV space
-  fiRgb2Yuv(ars, ags, abs, y, u, v, dim);
-
-  // Compute variation of chromatic components
-  float *southuTv = new float[dim];
-  float *southvTv = new float[dim];
-
-  variation4d(u, southuTv, SOUTH, halfL, width, height);
-  variation4d(v, southvTv, SOUTH, halfL, width, height);
+  // Sum of the weights 1 / (variation + epsilon) of the directions; the
+  // output planes hold the sums of the weighted directions
+  float *wSum = new float[dim];
 
-  for (int i = 0; i < dim; i++)
-    southuTv[i] += southvTv[i];
+  for (int d = 0; d < 4; d++) {
+    directional_interpolation(red, green, blue, ar, ag, ab, beta, directions[d], redx, redy, width, height);
 
-  // Interpolation in the east direction
-  float *are = new float[dim];
-  float *age = new float[dim];
-  float *abe = new float[dim];
+    // Convert interpolated image into YUV space; Y is not used
+    wxRgb2Yuv(ar, ag, ab, uTv, u, v, dim);
 
-  fpCopy(red, are, dim);
-  fpCopy(green, age, dim);
-  fpCopy(blue, abe, dim);
+    // Compute variation of chromatic components
+    variation4d(u, uTv, directions[d], halfL, width, height);
+    variation4d(v, u, directions[d], halfL, width, height);
 
-  g_directional(are, age, abe, beta, EAST, redx, redy, width, height);
-  rb_bilinear(are, age, abe, beta, redx, redy, width, height);
-
-  // Convert interpolated image into YUV space
-  fiRgb2Yuv(are, age, abe, y, u, v, dim);
-
-  // Compute variation of chromatic components
-  float *eastuTv = new float[dim];
-  float *eastvTv = new float[dim];
-
-  variation4d(u, eastuTv, EAST, halfL, width, height);
-  variation4d(v, eastvTv, EAST, halfL, width, height);
-
-  for (int i = 0; i < dim; i++)
-    eastuTv[i] += eastvTv[i];
-
-  // Interpolation in the west direction
-  float *arw = new float[dim];
-  float *agw = new float[dim];
-  float *abw = new float[dim];
-
-  fpCopy(red, arw, dim);
-  fpCopy(green, agw, dim);
-  fpCopy(blue, abw, dim);
-
-  g_directional(arw, agw, abw, beta, WEST, redx, redy, width, height);
-  rb_bilinear(arw, agw, abw, beta, redx, redy, width, height);
-
-  // Convert interpolated image into YUV space
-  fiRgb2Yuv(arw, agw, abw, y, u, v, dim);
-
-  // Compute variation of chromatic components
-  float *westuTv = new float[dim];
-  float *westvTv = new float[dim];
-
-  variation4d(u, westuTv, WEST, halfL, width, height);
-  variation4d(v, westvTv, WEST, halfL, width, height);
-
-  for (int i = 0; i < dim; i++)
-    westuTv[i] += westvTv[i];
-
-  // Pixel-level fusion of full color interpolated images
-  for (int i = 0; i < dim; i++) {
-    float wSum, wNorth, wSouth, wWest, wEast;
+    // Pixel-level fusion of full color interpolated images: each direction
+    // is added with its weight as soon as it is done
+#pragma omp parallel for
+    for (int i = 0; i < dim; i++) {
+      float w = 1.0f / (uTv[i] + u[i] + epsilon);
 
-    wSum = northuTv[i] + southuTv[i] + westuTv[i] + eastuTv[i];
-
-    if (wSum > fTiny) {
-      wNorth = 1.0f / (northuTv[i] + epsilon);
-      wSouth = 1.0f / (southuTv[i] + epsilon);
-      wWest = 1.0f / (westuTv[i] + epsilon);
-      wEast = 1.0f / (eastuTv[i] + epsilon);
-
-      wSum = wNorth + wSouth + wWest + wEast;
-
-      wNorth = wNorth / wSum;
-      wSouth = wSouth / wSum;
-      wWest = wWest / wSum;
-      wEast = wEast / wSum;
-
-    }
-    else {
-      wNorth = 0.25f;
-      wSouth = 0.25f;
-      wWest = 0.25f;
-      wEast = 0.25f;
+      if (d == 0) {
+        wSum[i] = w;
+        ored[i] = w * ar[i];
+        ogreen[i] = w * ag[i];
+        oblue[i] = w * ab[i];
+      }
+      else {
+        wSum[i] += w;
+        ored[i] += w * ar[i];
+        ogreen[i] += w * ag[i];
+        oblue[i] += w * ab[i];
+      }
     }
+  }
 
-    ored[i] = wNorth * arn[i] + wSouth * ars[i] + wWest * arw[i] + wEast * are[i];
-    ogreen[i] = wNorth * agn[i] + wSouth * ags[i] + wWest * agw[i] + wEast * age[i];
-    oblue[i] = wNorth * abn[i] + wSouth * abs[i] + wWest * abw[i] + wEast * abe[i];
+  // Normalize the weights. The variations are either zero or far above
+  // epsilon, so where all four are below it the weights are equal, as
+  // the plain average of the directions would have them.
+#pragma omp parallel for
+  for (int i = 0; i < dim; i++) {
+    ored[i] /= wSum[i];
+    ogreen[i] /= wSum[i];
+    oblue[i] /= wSum[i];
   }
 
   // Delete allocated memory
-  delete[] y; delete[] u; delete[] v;
-  delete[] arn; delete[] agn; delete[] abn;
-  delete[] ars; delete[] ags; delete[] abs;
-  delete[] are; delete[] age; delete[] abe;
-  delete[] arw; delete[] agw; delete[] abw;
-  delete[] northuTv; delete[] northvTv;
-  delete[] southuTv; delete[] southvTv;
-  delete[] westuTv; delete[] westvTv;
-  delete[] eastuTv; delete[] eastvTv;
+  delete[] ar; delete[] ag; delete[] ab;
+  delete[] u; delete[] v; delete[] uTv;
+  delete[] wSum;
 }
 
 /**
@@ -626,9 +632,9 @@ void adaptive_parameters (
   float *igreen = new float[dim];
   float *iblue = new float[dim];
 
-  fpCopy(red, ired, dim);
-  fpCopy(green, igreen, dim);
-  fpCopy(blue, iblue, dim);
+  wxCopy(red, ired, dim);
+  wxCopy(green, igreen, dim);
+  wxCopy(blue, iblue, dim);
 
   local_algorithm(red, green, blue, ired, igreen, iblue, 1.0f, epsilon, halfL,
       redx, redy, width, height);
@@ -638,7 +644,7 @@ void adaptive_parameters (
   float *u = new float[dim];
   float *v = new float[dim];
 
-  fiRgb2Yuv(ired, igreen, iblue, y, u, v, dim);
+  wxRgb2Yuv(ired, igreen, iblue, y, u, v, dim);
 
   // Identify inter-channel correlation by means of chromatic gradients
   float gradUC = 0.0f;
@@ -706,7 +712,6 @@ void adaptive_parameters (
  * @param[in]  beta  channel-correlation parameter.
  * @param[in]  h filtering parameter controlling the decay of the weights.
  * @param[in]  reswind  half-size of research window.
- * @param[in]  compwind  half-size of comparison window.
  * @param[in]  N  number of most similar pixels for filtering.
  * @param[in]  redx, redy  coordinates of the first red value in the CFA.
  * @param[in]  width, height  image size.
@@ -716,14 +721,14 @@ void adaptive_parameters (
 void g_filtering (
   float *red, float *green, float *blue,
   float *ogreen,
-  float beta, float h, int reswind, int compwind, int N,
+  float beta, float h, int reswind, int N,
   int redx, int redy, int width, int height
 ) {
   // Initializations
   int bluex = 1 - redx;
   int bluey = 1 - redy;
   int dim = width * height;
-  fpCopy(green, ogreen, dim);
+  wxCopy(green, ogreen, dim);
 
   // CFA mask
   unsigned char *cfamask = new unsigned char[dim];
@@ -743,7 +748,7 @@ void g_filtering (
 
   // Patch sizes
   int resdim = (2 * reswind + 1) * (2 * reswind + 1);
-  float compdim = (float) (2 * compwind + 1) * (2 * compwind + 1);
+  float compdim = (float) (2 * COMPWIND + 1) * (2 * COMPWIND + 1);
 
   // Adapt filter parameter to size of comparison window
   float filter = 3.0f * h * h * compdim;
@@ -751,31 +756,27 @@ void g_filtering (
   // Tabulate function exp(-x) for x>0
   int luttaille = (int) (LUTMAX * LUTPRECISION);
   float *lut = new float[luttaille];
-  wxFillExpLut(lut, luttaille);
+  sFillLut(lut, luttaille);
 
   // Apply nonlocal filtering
 #pragma omp parallel shared(red, green, blue, ogreen, cfamask, lut)
   {
-#pragma omp for schedule(dynamic) nowait
-    for (int y = compwind; y < height - compwind; y++) {
-      // Store patch distances
-      float *dist_list = new float[resdim];
-      float *index_list = new float[resdim];
+    // Patch distances and indices of the candidates
+    std::pair<float, int> *candidates = new std::pair<float, int>[resdim];
 
-      fpClear(dist_list, 0.0f, resdim);
-      fpClear(index_list, 0.0f, resdim);
-
-      for (int x = compwind; x < width - compwind; x++) {
+#pragma omp for schedule(dynamic) nowait
+    for (int y = COMPWIND; y < height - COMPWIND; y++) {
+      for (int x = COMPWIND; x < width - COMPWIND; x++) {
         // Index of current pixel
         int l = y * width + x;
 
         // Only filtering green component at pixels where is missing
         if (cfamask[l] != GREENPOSITION) {
           // Learning zone depending on the window size
-          int imin = MAX(x - reswind, compwind);
-          int jmin = MAX(y - reswind, compwind);
-          int imax = MIN(x + reswind, width - compwind - 1);
-          int jmax = MIN(y + reswind, height - compwind - 1);
+          int imin = MAX(x - reswind, COMPWIND);
+          int jmin = MAX(y - reswind, COMPWIND);
+          int imax = MIN(x + reswind, width - COMPWIND - 1);
+          int jmax = MIN(y + reswind, height - COMPWIND - 1);
 
 
           // Auxiliary variables for ordering distances
@@ -791,9 +792,9 @@ void g_filtering (
 
               // Compute distances
               float dist = 0.0f;
-              dist += fiL2FloatDist(red, red, x, y, i, j, compwind, compwind, width, width);
-              dist += fiL2FloatDist(green, green, x, y, i, j, compwind, compwind, width, width);
-              dist += fiL2FloatDist(blue, blue, x, y, i, j, compwind, compwind, width, width);
+              dist += l2_distance_r1(red, x, y, i, j, width);
+              dist += l2_distance_r1(green, x, y, i, j, width);
+              dist += l2_distance_r1(blue, x, y, i, j, width);
               dist /= filter;
 
               // Position of central pixel
@@ -805,41 +806,36 @@ void g_filtering (
               if ((i != x || j != y) && (dist < distMin))
                 distMin = dist;
 
-              dist_list[Nindex] = dist;
-              index_list[Nindex] = l0;
+              candidates[Nindex] = std::make_pair(dist, l0);
               Nindex++;
             }
           }
 
           // Set minimum distance to central pixel
-          dist_list[indexCentral] = distMin;
-
-          // Order distances
-          fpQuickSort(dist_list, index_list, Nindex);
+          candidates[indexCentral].first = distMin;
 
           // Adapt N to window size
-          float fN = (float) MIN(N, Nindex);
+          int nN = MIN(N, Nindex);
+
+          // Select the nN most similar pixels, in order of distance; ties
+          // go in the order of the window
+          std::nth_element(candidates, candidates + nN, candidates + Nindex);
+          std::sort(candidates, candidates + nN);
 
           // Compute weight distribution
-          int cindex;
-          float weight;
           float gvalue = 0.0f;
           float gweight = 0.0f;
-          float gcweight = 0.0f;
 
-          for (int k = 0; k < Nindex; k++) {
-            cindex = (int) index_list[k];
-            weight = wxSLUT(dist_list[k], lut);
+          for (int k = 0; k < nN; k++) {
+            int cindex = candidates[k].second;
+            float weight = sLUT(candidates[k].first, lut);
 
-            if (gcweight < fN) {
-              if (cfamask[l] == BLUEPOSITION)
-                gvalue += weight * green[cindex] - weight * beta * blue[cindex];
-              else
-                gvalue += weight * green[cindex] - weight * beta * red[cindex];
+            if (cfamask[l] == BLUEPOSITION)
+              gvalue += weight * green[cindex] - weight * beta * blue[cindex];
+            else
+              gvalue += weight * green[cindex] - weight * beta * red[cindex];
 
-              gcweight++;
-              gweight += weight;
-            }
+            gweight += weight;
           }
 
           // Set value to central pixel
@@ -855,11 +851,9 @@ void g_filtering (
             ogreen[l] = green[l];
         }
       }
-
-      // Delete alocated memory
-      delete[] dist_list;
-      delete[] index_list;
     }
+
+    delete[] candidates;
   }
 
   // Delete alocated memory
@@ -881,7 +875,6 @@ void g_filtering (
  * @param[in]  beta  channel-correlation parameter.
  * @param[in]  h filtering parameter controlling the decay of the weights.
  * @param[in]  reswind  half-size of research window.
- * @param[in]  compwind  half-size of comparison window.
  * @param[in]  N  number of most similar pixels for filtering.
  * @param[in]  redx, redy  coordinates of the first red value in the CFA.
  * @param[in]  width, height  image size.
@@ -891,15 +884,15 @@ void g_filtering (
 void rb_filtering (
   float *red, float *green, float *blue,
   float *ored, float *ogreen, float *oblue,
-  float beta, float h, int reswind, int compwind, int N,
+  float beta, float h, int reswind, int N,
   int redx, int redy, int width, int height
 ) {
   // Initializations
   int bluex = 1 - redx;
   int bluey = 1 - redy;
   int dim = width * height;
-  fpCopy(blue, oblue, dim);
-  fpCopy(red, ored, dim);
+  wxCopy(blue, oblue, dim);
+  wxCopy(red, ored, dim);
 
   // CFA mask
   unsigned char *cfamask = new unsigned char[dim];
@@ -919,7 +912,7 @@ void rb_filtering (
 
   // Patch sizes
   int resdim = (2 * reswind + 1) * (2 * reswind + 1);
-  float compdim = (float) (2 * compwind + 1) * (2 * compwind + 1);
+  float compdim = (float) (2 * COMPWIND + 1) * (2 * COMPWIND + 1);
 
   // Adapt filter parameter to size of comparison window
   float filter = 3.0f * h * h * compdim;
@@ -927,29 +920,25 @@ void rb_filtering (
   // Tabulate function exp(-x) for x>0.
   int luttaille = (int) (LUTMAX * LUTPRECISION);
   float *lut = new float[luttaille];
-  wxFillExpLut(lut, luttaille);
+  sFillLut(lut, luttaille);
 
   // Apply nonlocal filtering
 #pragma omp parallel shared(red, green, blue, ored, ogreen, oblue, cfamask, lut)
   {
-#pragma omp for schedule(dynamic) nowait
-    for (int y = compwind; y < height - compwind; y++) {
-      // Store patch distances
-      float *dist_list = new float[resdim];
-      float *index_list = new float[resdim];
-
-      fpClear(dist_list, 0.0f, resdim);
-      fpClear(index_list, 0.0f, resdim);
+    // Patch distances and indices of the candidates
+    std::pair<float, int> *candidates = new std::pair<float, int>[resdim];
 
-      for (int x = compwind; x < width - compwind; x++) {
+#pragma omp for schedule(dynamic) nowait
+    for (int y = COMPWIND; y < height - COMPWIND; y++) {
+      for (int x = COMPWIND; x < width - COMPWIND; x++) {
         // Index of current pixel
         int l = y * width + x;
 
         // Learning zone depending on the window size
-        int imin = MAX(x - reswind, compwind);
-        int jmin = MAX(y - reswind, compwind);
-        int imax = MIN(x + reswind, width - compwind - 1);
-        int jmax = MIN(y + reswind, height - compwind - 1);
+        int imin = MAX(x - reswind, COMPWIND);
+        int jmin = MAX(y - reswind, COMPWIND);
+        int imax = MIN(x + reswind, width - COMPWIND - 1);
+        int jmax = MIN(y + reswind, height - COMPWIND - 1);
 
         // Auxiliary variables for ordering distances
         int Nindex = 0;
@@ -964,9 +953,9 @@ void rb_filtering (
 
             // Compute distances
             float dist = 0.0f;
-            dist += fiL2FloatDist(red, red, x, y, i, j, compwind, compwind, width, width);
-            dist += fiL2FloatDist(green, green, x, y, i, j, compwind, compwind, width, width);
-            dist += fiL2FloatDist(blue, blue, x, y, i, j, compwind, compwind, width, width);
+            dist += l2_distance_r1(red, x, y, i, j, width);
+            dist += l2_distance_r1(green, x, y, i, j, width);
+            dist += l2_distance_r1(blue, x, y, i, j, width);
             dist /= filter;
 
             // Position of central pixel
@@ -977,46 +966,37 @@ void rb_filtering (
             if ((i != x || j != y) && (dist < distMin))
               distMin = dist;
 
-            dist_list[Nindex] = dist;
-            index_list[Nindex] = l0;
+            candidates[Nindex] = std::make_pair(dist, l0);
             Nindex++;
           }
         }
 
         // Set minimum distance to central pixel
-        dist_list[indexCentral] = distMin;
-
-        // Order distances
-        fpQuickSort(dist_list, index_list, Nindex);
+        candidates[indexCentral].first = distMin;
 
         // Adapt N to window size
-        float fN = (float) MIN(N, Nindex);
+        int nN = MIN(N, Nindex);
+
+        // Select the nN most similar pixels, in order of distance; ties go
+        // in the order of the window
+        std::nth_element(candidates, candidates + nN, candidates + Nindex);
+        std::sort(candidates, candidates + nN);
 
         // Compute weight distribution
-        int cindex;
-        float weight;
         float rvalue = 0.0f;
         float rweight = 0.0f;
-        float rcweight = 0.0f;
         float bvalue = 0.0f;
         float bweight = 0.0f;
-        float bcweight = 0.0f;
 
-        for (int k = 0; k < Nindex; k++) {
-          cindex = (int) index_list[k];
-          weight = wxSLUT(dist_list[k], lut);
+        for (int k = 0; k < nN; k++) {
+          int cindex = candidates[k].second;
+          float weight = sLUT(candidates[k].first, lut);
 
-          if (rcweight < fN) {
-            rvalue += weight * (red[cindex] - beta * ogreen[cindex]);
-            rcweight++;
-            rweight += weight;
-          }
+          rvalue += weight * (red[cindex] - beta * ogreen[cindex]);
+          rweight += weight;
 
-          if (bcweight < fN) {
-            bvalue += weight * (blue[cindex] - beta * ogreen[cindex]);
-            bcweight++;
-            bweight += weight;
-          }
+          bvalue += weight * (blue[cindex] - beta * ogreen[cindex]);
+          bweight += weight;
         }
 
         // Set value to central pixel if missing red or blue value
@@ -1030,11 +1010,9 @@ void rb_filtering (
         else
           oblue[l] = blue[l];
       }
-
-      // Delete allocated memory
-      delete[] dist_list;
-      delete[] index_list;
     }
+
+    delete[] candidates;
   }
 
   // Delete allocated memory
@@ -1065,7 +1043,6 @@ void rb_filtering (
  * @param[in]  halfL  half-size of the support zone where the variance of the
  *             chromatic components is computed.
  * @param[in]  reswind  half-size of research window.
- * @param[in]  compwind  half-size of comparison window.
  * @param[in]  N  number of most similar pixels for filtering.
  * @param[in]  redx, redy  coordinates of the first red value in the CFA.
  * @param[in]  width, height  image size.
@@ -1076,16 +1053,20 @@ void rb_filtering (
 int algorithm_chain (
   float *red, float *green, float *blue,
   float *ored, float *ogreen, float *oblue,
-  float beta, float h, float epsilon, float M, int halfL, int reswind, int compwind, int N,
+  float beta, float h, float epsilon, float M, int halfL, int reswind, int N,
   int redx, int redy, int width, int height
 ) {
   // Image size
   int dim = width * height;
+  clock_t start_time, end_time;
 
   // Estimate beta and h if not fixed
   if (beta == 0.0f) {
     fprintf(stderr, "adaptive_prameteres(red, green, blue, β: %5.2f, h: %5.2f, ε: %5.2f, M: %5.2f, halfL: %d, redx: %d, redy: %d, width: %d, height: %d)\n", beta, h, epsilon, M, halfL, redx, redy, width, height);
+    start_time = clock();
     adaptive_parameters(red, green, blue, beta, h, epsilon, M, halfL, redx, redy, width, height);
+    end_time = clock();
+    fprintf(stderr, "%6.3f seconds to estimate beta and h\n", double(end_time - start_time) / CLOCKS_PER_SEC);
   }
 
   fprintf(stderr, "beta: %2.5f\n", beta);
@@ -1096,8 +1077,13 @@ int algorithm_chain (
   float *igreen = new float[dim];
   float *iblue = new float[dim];
 
+  start_time = clock();
   local_algorithm(          red, green, blue,    ired, igreen, iblue,   beta, epsilon, halfL, redx, redy, width, height);
+  end_time = clock();
+  fprintf(stderr, "%6.3f seconds to interpolate locally\n", double(end_time - start_time) / CLOCKS_PER_SEC);
+#ifdef DUMP_STAGES
   write_image((char *)"demosaicked.tiff",        ired, igreen, iblue,   width, height);
+#endif
   //                              ________________/      /      /
   //                             /      ________________/      /
   //                            /      /      ________________/
@@ -1105,10 +1091,13 @@ int algorithm_chain (
   // Second step              |      |      |
   // Nonlocal filtering       |      |      |
   // of channel differences   |      |      |
-  g_filtering(              ired, igreen, iblue,       ogreen,          beta, h, reswind, compwind, N, redx, redy, width, height);
+  start_time = clock();
+  g_filtering(              ired, igreen, iblue,       ogreen,          beta, h, reswind, N, redx, redy, width, height);
   //                          |      |      |            |
   //                          |      |      |            |
-  rb_filtering(             ired, igreen, iblue,  ored, ogreen, oblue,  beta, h, reswind, compwind, N, redx, redy, width, height);
+  rb_filtering(             ired, igreen, iblue,  ored, ogreen, oblue,  beta, h, reswind, N, redx, redy, width, height);
+  end_time = clock();
+  fprintf(stderr, "%6.3f seconds to do nonlocal filtering\n", double(end_time - start_time) / CLOCKS_PER_SEC);
 
   // Delete allocated memory
   delete[] ired; delete[] igreen; delete[] iblue;
@@ -39,17 +39,19 @@
 #include <stdlib.h>
 #include <math.h>
 
-#include "libAuxiliary.h"
-
-#define GREENPOSITION 0
-#define REDPOSITION 1
-#define BLUEPOSITION 2
+#include "../libAuxiliary.h"
+#include "../cfa_mask.h"
 
 #define NORTH 0
 #define SOUTH 1
 #define WEST 2
 #define EAST 3
 
+#define COMPWIND 1            // half-size of the comparison window, that of l2_distance_r1()
+#define VARIATION_BLOCK 64    // pixels per prefix-sum block of variation4d()
+#define VARIATION_STRIP 256   // columns per work item of the north and south variation
+#define VARIATION_ROWS 16     // rows scanned together by the east and west variation
+
 /**
  * \brief Fill in missing green values at each pixel by local directional
  *        interpolation.
@@ -195,7 +197,6 @@ void adaptive_parameters (
  * @param[in]  beta  channel-correlation parameter.
  * @param[in]  h filtering parameter controlling the decay of the weights.
  * @param[in]  reswind  half-size of research window.
- * @param[in]  compwind  half-size of comparison window.
  * @param[in]  N  number of most similar pixels for filtering.
  * @param[in]  redx, redy  coordinates of the first red value in the CFA.
  * @param[in]  width, height  image size.
@@ -205,7 +206,7 @@ void adaptive_parameters (
 void g_filtering (
   float *red, float *green, float *blue,
   float *ogreen,
-  float beta, float h, int reswind, int compwind, int N,
+  float beta, float h, int reswind, int N,
   int redx, int redy, int width, int height
 );
 
@@ -223,7 +224,6 @@ void g_filtering (
  * @param[in]  beta  channel-correlation parameter.
  * @param[in]  h filtering parameter controlling the decay of the weights.
  * @param[in]  reswind  half-size of research window.
- * @param[in]  compwind  half-size of comparison window.
  * @param[in]  N  number of most similar pixels for filtering.
  * @param[in]  redx, redy  coordinates of the first red value in the CFA.
  * @param[in]  width, height  image size.
@@ -233,7 +233,7 @@ void g_filtering (
 void rb_filtering (
   float *red, float *green, float *blue,
   float *ored, float *ogreen, float *oblue,
-  float beta, float h, int reswind, int compwind, int N,
+  float beta, float h, int reswind, int N,
   int redx, int redy, int width, int height
 );
 
@@ -260,7 +260,6 @@ void rb_filtering (
  * @param[in]  halfL  half-size of the support zone where the variance of the
  *             chromatic components is computed.
  * @param[in]  reswind  half-size of research window.
- * @param[in]  compwind  half-size of comparison window.
  * @param[in]  N  number of most similar pixels for filtering.
  * @param[in]  redx, redy  coordinates of the first red value in the CFA.
  * @param[in]  width, height  image size.
@@ -271,7 +270,7 @@ void rb_filtering (
 int algorithm_chain (
   float *red, float *green, float *blue,
   float *ored, float *ogreen, float *oblue,
-  float beta, float h, float epsilon, float M, int halfL, int reswind, int compwind, int N,
+  float beta, float h, float epsilon, float M, int halfL, int reswind, int N,
   int redx, int redy, int width, int height
 );
 
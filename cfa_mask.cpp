@@ -5,34 +5,38 @@
 
 long x, y, p;
 
-unsigned char* exr_cfa_mask(unsigned width, unsigned height, unsigned imageWidth, unsigned imageHeight) {
-  unsigned char *mask = new unsigned char[width * height];
-
-  for (y = 0; y < height; y++) {
-    for (x = 0; x < width; x++) {
-      p = y * width + x;
-      if (
-          x + y >= imageWidth - 1 and                    // NW boundary
-          y > x - imageWidth - 1 and                     // NE boundary
-          x + y < imageWidth + 2 * imageHeight - 1 and   // SE boundary
-          x > y - imageWidth                             // SW boundary
-         ) {
-        if (y % 2 == 0) {
-          mask[p] = GREENPOSITION;
+void exr_cfa_mask_row(unsigned char *row, long y, unsigned width, unsigned imageWidth, unsigned imageHeight) {
+  for (long x = 0; x < (long)width; x++) {
+    if (
+        y >= 0 and
+        x + y >= imageWidth - 1 and                    // NW boundary
+        y > x - imageWidth - 1 and                     // NE boundary
+        x + y < imageWidth + 2 * imageHeight - 1 and   // SE boundary
+        x > y - imageWidth                             // SW boundary
+       ) {
+      if (y % 2 == 0) {
+        row[x] = GREENPOSITION;
+      }
+      else {
+        if ((x + y - 1) % 4 == 0 || (x + y - 1) % 4 == 1) {
+          row[x] = REDPOSITION;
         }
         else {
-          if ((x + y - 1) % 4 == 0 || (x + y - 1) % 4 == 1) {
-            mask[p] = REDPOSITION;
-          }
-          else {
-            mask[p] = BLUEPOSITION;
-          }
+          row[x] = BLUEPOSITION;
         }
       }
-      else {
-        mask[p] = BLANK;
-      }
     }
+    else {
+      row[x] = BLANK;
+    }
+  }
+}
+
+unsigned char* exr_cfa_mask(unsigned width, unsigned height, unsigned imageWidth, unsigned imageHeight) {
+  unsigned char *mask = new unsigned char[width * height];
+
+  for (y = 0; y < height; y++) {
+    exr_cfa_mask_row(mask + y * width, y, width, imageWidth, imageHeight);
   }
 
   return mask;
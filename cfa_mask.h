@@ -10,4 +10,8 @@
 unsigned char* exr_cfa_mask(unsigned width, unsigned height, unsigned imageWidth, unsigned imageHeight);
 unsigned char* bggr_cfa_mask(unsigned width, unsigned height);
 
+// One row of the EXR mask, for the streaming interpolation (blank if y < 0
+// or if the row is past the diamond)
+void exr_cfa_mask_row(unsigned char *row, long y, unsigned width, unsigned imageWidth, unsigned imageHeight);
+
 #endif
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <error.h>
+#include <ctime>
+#include <iostream>
+#include <iomanip>
+
+#include "db_args.h"
+#include "termcolor.h"
+#include "io_tiff.h"
+#include "exr_merge.h" // exr_orientation, exr_red_position()
+#include "Duran-Buades-2015/libdemosaic.h"
+
+using namespace std;
+using namespace termcolor;
+
+// --------------------------------------------------------------------
+void run_db (struct argp_state* state) {
+  PARSE_ARGS_DB;
+
+  clock_t start_time, end_time;
+  double elapsed;
+  float *bayer;
+  size_t nx = 0, ny = 0;
+
+  cerr.setf(ios::fixed, ios::floatfield);
+
+  /* TIFF 16-bit grayscale -> float input */
+  start_time = clock();
+  cerr << grey << "input file: " << white << args.input_file << reset << endl;
+  if (NULL == (bayer = read_tiff_gray16_f32(args.input_file, &nx, &ny, NULL))) {
+    cerr << on_red << "error while reading from " << args.input_file << reset << endl;
+    exit(EXIT_FAILURE);
+  }
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " reading input" << reset << endl;
+
+  int width = (int) nx;
+  int height = (int) ny;
+  int dim = width * height;
+
+  // Red is where the sensor has it, as in the merged EXR array
+  exr_orientation orient;
+  if (not exr_orientation_init(&orient, args.orientation, width, height)) {
+    cerr << on_red << "unsupported orientation " << args.orientation << reset << endl;
+    exit(EXIT_FAILURE);
+  }
+  cerr << grey << "orientation: " << white << orient.exif << reset << endl;
+  int redx, redy;
+  exr_red_position(orient, &redx, &redy);
+
+  // Compute h in terms of beta if not automatically determined
+  float beta = args.beta;
+  float h = 0.0f;
+  if (beta != 0.0f) {
+    h = (310.0f * beta - 214.0f) / 3.0f;
+  }
+
+  // Fixed parameters
+  float epsilon = fTiny; // avoids numerical intricacies in the local chromatic variation
+  float M = 13.0f;       // luminance gradient above which a discontinuity is considered
+  int halfL = 1;         // half-size of the support of the chromatic variation
+  int reswind = 10;      // half-size of the search window
+  int N = 10;            // number of most similar pixels used for filtering
+
+  /* process */
+  start_time = clock();
+  float *data_out = new float[3 * dim];
+  algorithm_chain(
+    bayer, bayer, bayer,
+    data_out, data_out + dim, data_out + 2 * dim,
+    beta, h, epsilon, M, halfL, reswind, N,
+    redx, redy, width, height
+  );
+  free(bayer);
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " debayering" << reset << endl;
+
+  cerr << grey << "writing output to " << white << args.output_file << reset << endl;
+  start_time = clock();
+  if (0 != write_tiff_rgb_f32(args.output_file, data_out, nx, ny)) {
+    cerr << on_red << "error while writing to " << args.output_file << reset << endl;
+    exit(EXIT_FAILURE);
+  }
+  delete[] data_out;
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " writing" << reset << endl;
+} // run_db()
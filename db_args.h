@@ -0,0 +1,136 @@
+#include <argp.h>
+
+// --------------------
+// ## db command parser
+//
+struct arg_db {
+  int orientation;
+  float beta;
+  char* input_file;
+  char* output_file;
+};
+
+static char args_doc_db[] = "bayer.tiff output.tiff";
+
+static char doc_db[] =
+"\n"
+"Debayer one frame by adaptive inter-channel correlation (Duran-Buades)\n"
+"\n"
+"Input:\n"
+"  A raw Bayer frame extracted with dcraw, for example one of\n"
+"  the two frames of an EXR image:\n"
+"\n"
+"    dcraw -v -w -d -s all -4 -T <source.RAF>\n"
+"\n"
+"Output:\n"
+"  Demosaicked 16-bit RGB TIFF image, in the orientation of the frame\n"
+"\n"
+"\v"
+"The algorithm proceeds as follows:\n"
+"\n"
+"  1. Unless fixed with -b, the channel-correlation parameter\n"
+"     beta and the decay h of the nonlocal weights are estimated\n"
+"     from the chromatic gradients of a local interpolation with\n"
+"     beta = 1.\n"
+"\n"
+"  2. Green is interpolated in each of the four directions (N, S,\n"
+"     E, W), red and blue bilinearly on the channel differences.\n"
+"     The four images are blended, each weighted by the inverse\n"
+"     of its local chromatic variation.\n"
+"\n"
+"  3. The result is refined by nonlocal filtering of the channel\n"
+"     differences, over the most similar pixels of a search window.\n"
+"\n"
+"The position of red in the frame follows from the orientation given\n"
+"by -o (see `exiftool -Orientation -n source.RAF`).\n"
+"\n"
+"Portions of code from:\n"
+"\n"
+"  Joan Duran and Antoni Buades,\n"
+"  Self-Similarity and Spectral Correlation Adaptive\n"
+"  Algorithm for Color Demosaicking,\n"
+"  IEEE Trans. Image Process., 23(9), 4031-4040 (2014).\n"
+"\n"
+;
+
+static error_t parse_db_command(int key, char* arg, struct argp_state* state) {
+  struct arg_db* arguments = (struct arg_db*)state->input;
+  char **nonopt;
+
+  assert( arguments );
+
+  switch(key) {
+    case 'o':
+      arguments->orientation = atoi(arg);
+      if (arguments->orientation != 1 and arguments->orientation != 3 and arguments->orientation != 6 and arguments->orientation != 8) {
+        argp_error(state, "Supported orientations are 1, 3, 6 and 8");
+      }
+      break;
+
+    case 'b':
+      arguments->beta = atof(arg);
+      if (arguments->beta < 0 or arguments->beta > 1) {
+        argp_error(state, "beta must be in the range (0, 1], or 0 to estimate it");
+      }
+      break;
+
+    case ARGP_KEY_NO_ARGS:
+      argp_usage (state);
+      break;
+
+    case ARGP_KEY_ARG: // non-option argument
+      // Here we know that state->arg_num == 0, since we force option parsing
+      // to end before any non-option arguments can be seen
+      nonopt = &state->argv[state->next];
+      state->next = state->argc; // we're done
+
+      arguments->input_file = arg;
+      arguments->output_file = nonopt[0];
+      break;
+
+    case ARGP_KEY_END:
+      if (state->arg_num < 2) {
+        argp_error(state, "Not enough arguments");
+      }
+      if (state->arg_num > 2) {
+        argp_error(state, "Extra arguments");
+      }
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+
+  return 0;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+static struct argp_option options_db[] = {
+  {"orientation", 'o', "N", 0, "EXIF orientation of the frame: 1, 3, 6 or 8 (default 1 for landscape, 8 for portrait)" },
+  {"beta", 'b', "BETA", 0, "Channel-correlation parameter in (0, 1] (default: estimated)" },
+  { 0 }
+};
+
+static struct argp argp_db = {
+  options_db,
+  parse_db_command,
+  args_doc_db,
+  doc_db
+};
+#pragma GCC diagnostic pop
+
+#define PARSE_ARGS_DB \
+  struct arg_db args; \
+  int    argc = state->argc - state->next + 1; \
+  char** argv = &state->argv[state->next - 1]; \
+  char*  argv0 =  argv[0]; \
+  argv[0] = (char *)malloc(strlen((char *)(state->name)) + strlen(" db") + 1); \
+  if (!argv[0]) argp_failure(state, 1, ENOMEM, 0); \
+  sprintf(argv[0], "%s db", state->name); \
+  args.orientation = 0; \
+  args.beta = 0; \
+  argp_parse(&argp_db, argc, argv, ARGP_IN_ORDER, &argc, &args); \
+  free(argv[0]); \
+  argv[0] = argv0; \
+  state->next += argc - 1;
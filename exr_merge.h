@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2016, Gene Selkov <selkovjr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   exr_merge.h
+ * @brief  Merging of the EXR frames into the tilted canvas
+ *
+ * The frames are rotated 45° CCW and interleaved on the canvas of the
+ * sensor, in its own (landscape) orientation:
+ *
+ *   B........G
+ *   ..........
+ *   ..........
+ *   G........R
+ *
+ * The sensor pixel (srow, scol) lands on the pair of canvas sites x0, x0 + 1
+ * of the row y, the first one taken from the first frame and the second
+ * one from the second frame:
+ *
+ *   x0 = scol + srow,    y = sensorWidth - 1 - scol + srow
+ *
+ * dcraw turns the frames to the orientation the camera was held in, so
+ * the frame pixel (row, col) is first taken back to the sensor pixel it
+ * came from. Both maps are affine, and so is their product, which is all
+ * the merge needs to know about the orientation.
+ *
+ * Along a canvas row, the pairs are 2 sites apart and the frame pixels
+ * they come from are a constant stride apart, so a row is merged with
+ * increments only. Each row is merged independently of the others, in a
+ * single CFA plane, of float or of the sample type of the frames.
+ *
+ * @author Gene Selkov <selkovjr@gmail.com>
+ */
+
+#ifndef EXR_MERGE_H
+#define EXR_MERGE_H
+
+#include <string.h>
+#include "exr_stencil.h" // exr_color()
+
+#define MERGE_BAND 16   // canvas rows per work item of the parallel merge
+
+
+/**
+ * \brief  Orientation of the frames with respect to the sensor
+ *
+ * Orientations are numbered as in EXIF:
+ *
+ *   1  horizontal (normal)   the frames are the sensor
+ *   3  rotate 180            upside down
+ *   6  rotate 90 CW          portrait, the frames are the sensor turned 90° CW
+ *   8  rotate 270 CW         portrait, the frames are the sensor turned 90° CCW
+ *
+ */
+
+struct exr_orientation {
+  int exif;                // EXIF orientation
+  long width, height;      // size of the frames
+  long ow, oh;             // size of the sensor, as in exr_cfa_mask()
+  int srr, src, scr, scc;  // srow = srr * row + src * col + (srr + src < 0 ? oh - 1 : 0), same for scol
+  long x00, y0;            // canvas site of the frame pixel (0, 0)
+  int xr, xc, yr, yc;      // x0 = x00 + xr * row + xc * col, y = y0 + yr * row + yc * col
+};
+
+
+/**
+ * \brief  Take a pixel of a frame-oriented image back to the sensor orientation
+ *
+ * @param[in]   o          orientation
+ * @param[in]   row, col   pixel of the frame-oriented image
+ * @param[in]   sw, sh     size of the image in the sensor orientation
+ * @param[out]  srow, scol pixel in the sensor orientation
+ *
+ */
+
+template <typename T>
+static inline void exr_to_sensor(const exr_orientation &o, T row, T col, T sw, T sh, T *srow, T *scol) {
+  *srow = o.srr * row + o.src * col + (o.srr + o.src < 0 ? sh - 1 : 0);
+  *scol = o.scr * row + o.scc * col + (o.scr + o.scc < 0 ? sw - 1 : 0);
+}
+
+
+/**
+ * \brief  Set up the orientation of frames of the given size
+ *
+ * @param[out]  o       orientation
+ * @param[in]   exif    EXIF orientation 1, 3, 6 or 8, or 0 to take landscape
+ *                      frames as 1 and portrait ones as 8
+ * @param[in]   width, height  size of the frames
+ * @return  false if the orientation is not supported
+ *
+ */
+
+static inline bool exr_orientation_init(exr_orientation *o, int exif, long width, long height) {
+  if (exif == 0) exif = width > height ? 1 : 8;
+
+  o->exif = exif;
+  o->width = width;
+  o->height = height;
+  switch (exif) {
+    case 1: o->srr =  1; o->src =  0; o->scr =  0; o->scc =  1; break;
+    case 3: o->srr = -1; o->src =  0; o->scr =  0; o->scc = -1; break;
+    case 6: o->srr =  0; o->src = -1; o->scr =  1; o->scc =  0; break;
+    case 8: o->srr =  0; o->src =  1; o->scr = -1; o->scc =  0; break;
+    default: return false;
+  }
+  bool turned = o->srr == 0;
+  o->ow = turned ? height : width;
+  o->oh = turned ? width : height;
+
+  // x0 = scol + srow, y = ow - 1 - scol + srow
+  long sr0, sc0;
+  exr_to_sensor(*o, 0L, 0L, o->ow, o->oh, &sr0, &sc0);
+  o->x00 = sc0 + sr0;
+  o->y0 = o->ow - 1 - sc0 + sr0;
+  o->xr = o->scr + o->srr;
+  o->xc = o->scc + o->src;
+  o->yr = o->srr - o->scr;
+  o->yc = o->src - o->scc;
+  return true;
+}
+
+
+/**
+ * \brief  Position of red in the first 2×2 block of a frame
+ *
+ * The sensor is BGGR, with red at odd rows and columns. Turning the frame
+ * moves red by the parity of its size.
+ *
+ * @param[in]   o           orientation
+ * @param[out]  redx, redy  column and row of red, 0 or 1
+ *
+ */
+
+static inline void exr_red_position(const exr_orientation &o, int *redx, int *redy) {
+  *redx = *redy = 1;
+  for (long row = 0; row < 2; row++) {
+    for (long col = 0; col < 2; col++) {
+      long srow, scol;
+      exr_to_sensor(o, row, col, o.ow, o.oh, &srow, &scol);
+      if (srow % 2 and scol % 2) {
+        *redx = col;
+        *redy = row;
+      }
+    }
+  }
+}
+
+
+/**
+ * \brief  Pair source: two sensor frames
+ *
+ * The pair at x0 gets the pixel k of either frame.
+ *
+ */
+
+template <typename T>
+struct exr_frame_pairs {
+  const T *frame0, *frame1;
+
+  template <typename R>
+  inline void operator()(R *row, long x0, long, long k) const {
+    row[x0] = frame0[k];
+    row[x0 + 1] = frame1[k];
+  }
+};
+
+
+/**
+ * \brief  Pair source: the R, G, B planes of an interlaced canvas
+ *
+ * Each site gets the plane of its own color, at the same place.
+ *
+ */
+
+struct exr_plane_pairs {
+  const float *plane[3]; // red, green, blue canvas planes
+  long width;
+
+  template <typename R>
+  inline void operator()(R *row, long x0, long y, long) const {
+    const float *p = plane[exr_color(x0, y) - REDPOSITION] + y * width;
+    row[x0] = p[x0];
+    row[x0 + 1] = p[x0 + 1];
+  }
+};
+
+
+/**
+ * \brief  Merge one canvas row
+ *
+ * @param[in]   pairs  pair source, called as pairs(row, x0, y, k) for the
+ *                     frame pixel k landing on x0, x0 + 1
+ * @param[out]  row    canvas row y; it is blank outside of the frames
+ * @param[in]   y      canvas row; rows outside of the canvas are blank
+ * @param[in]   o      orientation of the frames
+ *
+ */
+
+template <class Pairs, typename R>
+static inline void exr_merge_row(const Pairs &pairs, R *row, long y, const exr_orientation &o) {
+  long cols = o.width;
+
+  memset(row, 0, (o.width + o.height) * sizeof(R));
+
+  // On the row, col = c0 + s * row, and x0 moves by xr + xc * s = ±2 per
+  // frame row. The frame rows are walked in the direction of growing x0.
+  long c0 = o.yc * (y - o.y0);
+  long s = -o.yr * o.yc;
+  long ra = MAX(0, s > 0 ? -c0 : c0 - cols + 1);
+  long rb = MIN(o.height, s > 0 ? cols - c0 : c0 + 1);
+  if (rb <= ra) return;
+
+  long dr = o.xr + o.xc * s > 0 ? 1 : -1;
+  long r = dr > 0 ? ra : rb - 1;
+  long c = c0 + s * r;
+  long x0 = o.x00 + o.xr * r + o.xc * c;
+  long k = r * cols + c;
+  long dk = dr * (cols + s);
+
+  for (long n = rb - ra; n > 0; n--, x0 += 2, k += dk) {
+    pairs(row, x0, y, k);
+  }
+}
+
+
+/**
+ * \brief  Merge the whole canvas, in parallel bands of MERGE_BAND rows
+ *
+ * @param[in]   pairs  pair source
+ * @param[out]  cfa    width x width CFA plane, width = o.width + o.height
+ * @param[in]   o      orientation of the frames
+ *
+ */
+
+template <class Pairs, typename R>
+static void exr_merge(const Pairs &pairs, R *cfa, const exr_orientation &o) {
+  long width = o.width + o.height;
+
+  #pragma omp parallel for schedule(dynamic, MERGE_BAND)
+  for (long y = 0; y < width; y++) {
+    exr_merge_row(pairs, cfa + y * width, y, o);
+  }
+}
+
+#endif
@@ -0,0 +1,379 @@
+/*
+ * Copyright (c) 2016, Gene Selkov <selkovjr@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file   exr_stencil.h
+ * @brief  Interpolation stencils of the tilted EXR lattice
+ *
+ * All stencils used to fill in the missing colors on the EXR canvas are
+ * inverse distance weighted averages of sites of one color. They are
+ * described here by their tap offsets only; the weights are derived from
+ * the tap distances and normalised at compile time. The interior stencils
+ * are found by searching the lattice around a site of each phase, and the
+ * rules of the diamond edges list their taps explicitly.
+ *
+ * @author Gene Selkov <selkovjr@gmail.com>
+ */
+
+#ifndef EXR_STENCIL_H
+#define EXR_STENCIL_H
+
+#include "cfa_mask.h"
+#include "libAuxiliary.h" // MAX(), MIN()
+
+#define DIAG 1.4142136
+#define DIAG12 2.236 // sqrt(5)
+
+#define EXR_MAX_TAPS 6
+
+
+struct exr_tap {
+  int dx, dy;   // offset from the interpolated site
+  float w = 0; // weight
+};
+
+struct exr_stencil {
+  int n;      // number of taps
+  exr_tap tap[EXR_MAX_TAPS];
+};
+
+
+/**
+ * \brief  Color of a site of the EXR lattice, as in exr_cfa_mask()
+ *
+ * Even rows are green; odd rows hold red and blue in pairs, red where
+ * (x + y - 1) % 4 is 0 or 1. The phase does not depend on the size of the
+ * diamond.
+ *
+ */
+
+constexpr int exr_color(int x, int y) {
+  return
+    (y & 1) == 0 ? GREENPOSITION :
+    ((x + y - 1) & 3) < 2 ? REDPOSITION : BLUEPOSITION;
+}
+
+
+/**
+ * \brief  Distance to a tap, using the lattice constants DIAG and DIAG12
+ *
+ */
+
+constexpr double exr_distance(int dx, int dy) {
+  int ax = dx < 0 ? -dx : dx;
+  int ay = dy < 0 ? -dy : dy;
+
+  return
+    ax == 0 ? ay :
+    ay == 0 ? ax :
+    ax == ay ? ax * DIAG :
+    DIAG12; // the knight's move, (1, 2) or (2, 1)
+}
+
+
+/**
+ * \brief  Weigh the taps of a stencil by their inverse distance
+ *
+ * @param[in]  s  stencil with tap offsets
+ * @param[in]  normalise  if true, the weights add up to one
+ *
+ */
+
+constexpr exr_stencil exr_idw(exr_stencil s, bool normalise = true) {
+  double sum = 0;
+  for (int i = 0; i < s.n; i++) {
+    sum += 1 / exr_distance(s.tap[i].dx, s.tap[i].dy);
+  }
+  for (int i = 0; i < s.n; i++) {
+    s.tap[i].w = 1 / exr_distance(s.tap[i].dx, s.tap[i].dy) / (normalise ? sum : 1);
+  }
+  return s;
+}
+
+
+/**
+ * \brief  Mirror a stencil across the row of its site
+ *
+ */
+
+constexpr exr_stencil exr_flip(exr_stencil s) {
+  for (int i = 0; i < s.n; i++) {
+    s.tap[i].dy = -s.tap[i].dy;
+  }
+  return s;
+}
+
+
+/**
+ * \brief  Keep only the diagonal taps of a stencil, weighed again
+ *
+ */
+
+constexpr exr_stencil exr_diagonal(exr_stencil s) {
+  exr_stencil d = {0, {}};
+  for (int i = 0; i < s.n; i++) {
+    if (s.tap[i].dx != 0 and s.tap[i].dy != 0) d.tap[d.n++] = s.tap[i];
+  }
+  return exr_idw(d);
+}
+
+
+/**
+ * \brief  IDW stencil of the nearest sites of a color around (x, y)
+ *
+ * The lattice is searched along rays from the site, up to reach steps,
+ * and the first site of the color on each ray becomes a tap.
+ *
+ * @param[in]  x, y  a site of the phase the stencil is for
+ * @param[in]  color  the color to interpolate
+ * @param[in]  reach  number of steps along each ray
+ * @param[in]  diagonal  search the diagonal rays as well as the axes
+ *
+ */
+
+constexpr exr_stencil exr_nearest(int x, int y, int color, int reach, bool diagonal) {
+  const int ray[8][2] = {{-1, -1}, {0, -1}, {1, -1}, {-1, 0}, {1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+  exr_stencil s = {0, {}};
+
+  for (int r = 0; r < 8; r++) {
+    if (not diagonal and ray[r][0] != 0 and ray[r][1] != 0) continue;
+    for (int k = 1; k <= reach; k++) {
+      int dx = k * ray[r][0], dy = k * ray[r][1];
+      if (exr_color(x + dx, y + dy) == color) {
+        s.tap[s.n++] = {dx, dy};
+        break;
+      }
+    }
+  }
+  return exr_idw(s);
+}
+
+
+// The color interpolated at red and blue sites
+constexpr int exr_other(int color) {
+  return color == REDPOSITION ? BLUEPOSITION : REDPOSITION;
+}
+
+
+// ----------------------------------------------------------------------------
+// Interior stencils
+//
+// Green sites take the two diagonal neighbours and the vertical one of the
+// interpolated color; tables are indexed by (x + y) % 4 of the green site.
+//
+//     0       1       2       3      (blue at green)
+//   . B B   B B .   B . .   . . B
+//   . * .   . * .   . * .   . * .
+//   B . .   . . B   . B B   B B .
+//
+#define EXR_GREEN(c) { \
+  exr_nearest(0, 0, c, 1, true), \
+  exr_nearest(1, 0, c, 1, true), \
+  exr_nearest(2, 0, c, 1, true), \
+  exr_nearest(3, 0, c, 1, true)  \
+}
+
+constexpr exr_stencil EXR_GREEN_BLUE[4] = EXR_GREEN(BLUEPOSITION);
+constexpr exr_stencil EXR_GREEN_RED[4] = EXR_GREEN(REDPOSITION);
+
+// linear takes red at green sites as the average of the two diagonal
+// neighbours only.
+//
+//     0       1       2       3      (red at green)
+//   R . .   . . R   . . R   R . .
+//   . * .   . * .   . * .   . * .
+//   . . R   R . .   R . .   . . R
+//
+constexpr exr_stencil EXR_GREEN_RED_DIAGONAL[4] = {
+  exr_diagonal(EXR_GREEN_RED[0]),
+  exr_diagonal(EXR_GREEN_RED[1]),
+  exr_diagonal(EXR_GREEN_RED[2]),
+  exr_diagonal(EXR_GREEN_RED[3])
+};
+
+// Red and blue sites take the nearest site of the other color in each axial
+// direction: three two pixels away and one next to them in the row. The
+// table is indexed by (x + y) % 4 of the site; red pairs start at 1, blue
+// pairs at 3.
+//
+//     first         second
+//   . . B . .     . . . B .
+//   . . . . .     . . . . .
+//   . B * R B     . B R * B
+//   . . . . .     . . . . .
+//   . . B . .     . . . B .
+//
+constexpr exr_stencil EXR_PAIR[4] = {
+  exr_nearest(-1, 1, exr_other(exr_color(-1, 1)), 2, false),
+  exr_nearest(0, 1, exr_other(exr_color(0, 1)), 2, false),
+  exr_nearest(1, 1, exr_other(exr_color(1, 1)), 2, false),
+  exr_nearest(2, 1, exr_other(exr_color(2, 1)), 2, false)
+};
+
+// The six green neighbours of a red or blue site, not normalised; the edge
+// band sums the weights of the taps inside the diamond.
+constexpr exr_stencil EXR_GREEN_RING = exr_idw({6, {{-1, -1}, {0, -1}, {1, -1}, {-1, 1}, {0, 1}, {1, 1}}}, false);
+
+
+// ----------------------------------------------------------------------------
+// Edge rules
+//
+// Named by the edge, the color of the site and the interpolated color. The
+// rules of the SW and SE edges mirror those of the NW and NE edges. A rule
+// ending in _E or _W fills the neighbour to the east or west of the site on
+// the edge, and its taps are relative to that neighbour.
+
+// NW edge, green site: the closest blue pixels
+//
+//     B B . .
+//   * e . . .
+// B B . . B b
+//
+constexpr exr_stencil EXR_NW_GREEN_BLUE = exr_idw({4, {{-1, 1}, {0, 1}, {1, -1}, {2, -1}}});
+constexpr exr_stencil EXR_NW_GREEN_BLUE_E = exr_idw({5, {{-2, 1}, {-1, 1}, {0, -1}, {1, -1}, {2, 1}}});
+constexpr exr_stencil EXR_SW_GREEN_BLUE = exr_flip(EXR_NW_GREEN_BLUE);
+constexpr exr_stencil EXR_SW_GREEN_BLUE_E = exr_flip(EXR_NW_GREEN_BLUE_E);
+
+// NE edge, green site: the underlying blue block, to the inner green pixel
+// (w), which is copied to the outer one (*)
+//
+// b b . .
+// . . . w *
+// . . B B . .
+//
+constexpr exr_stencil EXR_NE_GREEN_BLUE_W = exr_idw({2, {{-1, 1}, {0, 1}}});
+constexpr exr_stencil EXR_SE_GREEN_BLUE_W = exr_flip(EXR_NE_GREEN_BLUE_W);
+
+// NE edge, red site: the closest two blue blocks
+//
+//  Inner       Outer
+//
+// . B w *     . B - *
+// . . | \ .   . . / | .
+// . . B B .   . . B B .
+//
+constexpr exr_stencil EXR_NE_RED_BLUE = exr_idw({3, {{0, 2}, {-1, 2}, {-2, 0}}});
+constexpr exr_stencil EXR_NE_RED_BLUE_W = exr_idw({3, {{0, 2}, {1, 2}, {-1, 0}}});
+constexpr exr_stencil EXR_SE_RED_BLUE = exr_flip(EXR_NE_RED_BLUE);
+
+// NW edge, green site: the underlying red block, to the inner green pixel
+// (e), which is copied to the outer one (*)
+//
+//     . . r r
+//   * e . . .
+// . . R R . .
+//
+constexpr exr_stencil EXR_NW_GREEN_RED_E = exr_idw({2, {{0, 1}, {1, 1}}});
+constexpr exr_stencil EXR_SW_GREEN_RED_E = exr_flip(EXR_NW_GREEN_RED_E);
+
+// NW edge, blue site: the closest two red blocks
+//
+//  Inner       Outer
+//
+//   * e R .     * - R .
+// . / | . .   . | \ . .
+// . R R . .   . R R . .
+//
+constexpr exr_stencil EXR_NW_BLUE_RED = exr_idw({3, {{0, 2}, {1, 2}, {2, 0}}});
+constexpr exr_stencil EXR_NW_BLUE_RED_E = exr_idw({3, {{-1, 2}, {0, 2}, {1, 0}}});
+constexpr exr_stencil EXR_SW_BLUE_RED = exr_flip(EXR_NW_BLUE_RED);
+constexpr exr_stencil EXR_SW_BLUE_RED_E = exr_flip(EXR_NW_BLUE_RED_E);
+
+
+/**
+ * \brief  Apply a stencil of N taps to the site at v
+ *
+ */
+
+template <int N>
+static inline float exr_apply(const float *v, const exr_stencil &s, int width) {
+  float sum = 0;
+  for (int i = 0; i < N; i++) {
+    sum += s.tap[i].w * v[s.tap[i].dy * width + s.tap[i].dx];
+  }
+  return sum;
+}
+
+static inline float exr_apply(const float *v, const exr_stencil &s, int width) {
+  float sum = 0;
+  for (int i = 0; i < s.n; i++) {
+    sum += s.tap[i].w * v[s.tap[i].dy * width + s.tap[i].dx];
+  }
+  return sum;
+}
+
+
+/**
+ * \brief  Interior of an odd row, where green is not in the edge band
+ *
+ * The band takes the red and blue sites within 4 pixels of the diamond
+ * edges:
+ *
+ *   x + y < origWidth + 3                       (NW edge)
+ *   x >= y + origWidth - 3                      (NE edge)
+ *   x + y >= origWidth + 2 * origHeight - 5     (SE edge)
+ *   y >= x + origWidth - 4                      (SW edge)
+ *
+ * @param[in]   y  odd canvas row
+ * @param[in]   xa, xb  span of the row (see exr_row_span())
+ * @param[out]  ia, ib  the interior is ia <= x < ib
+ *
+ */
+
+static inline void exr_green_interior(int y, int xa, int xb, int origWidth, int origHeight, int *ia, int *ib) {
+  *ia = MAX(xa, MAX(origWidth + 3 - y, y - origWidth + 5));
+  *ib = MIN(xb, MIN(y + origWidth - 3, origWidth + 2 * origHeight - 5 - y));
+  if (*ib < *ia) *ib = *ia;
+}
+
+
+/**
+ * \brief  Green at a red or blue site of the edge band
+ *
+ * Inverse distance weighting of those of the six green neighbours that are
+ * inside the diamond. In the west and east corners of the canvas, the
+ * neighbours on the outer side are not on the canvas and are not tested.
+ *
+ * @param[in]  green, mask  row of the site in the green plane and the mask
+ * @param[in]  x  column of the site
+ *
+ */
+
+static inline float exr_green_edge(const float *green, const unsigned char *mask, int x, int width) {
+  int p = x;
+
+  if (x == 0) { // West corner red
+    return (green[p - width + 1] + green[p + width + 1]) / 2;
+  }
+  if (x == width - 1) { // East corner blue
+    return (green[p - width - 1] + green[p + width - 1]) / 2;
+  }
+
+  float avg = 0;
+  float weight = 0;
+  for (int i = 0; i < EXR_GREEN_RING.n; i++) {
+    const exr_tap &t = EXR_GREEN_RING.tap[i];
+    int q = p + t.dy * width + t.dx;
+    if (mask[q] != BLANK) {
+      avg += t.w * green[q];
+      weight += t.w;
+    }
+  }
+  return avg / weight;
+}
+
+#endif
@@ -25,6 +25,12 @@ static error_t parse_toplevel (int key, char *arg, struct argp_state *state) {
       else if(strcmp(arg, "linear") == 0) {
         run_linear(state);
       }
+      else if(strcmp(arg, "merge") == 0) {
+        run_merge(state);
+      }
+      else if(strcmp(arg, "db") == 0) {
+        run_db(state);
+      }
       else if(strcmp(arg, "rotate") == 0) {
         run_rotate(state);
       }
@@ -63,6 +69,7 @@ int main(int argc, char **argv) {
     "Version: %s\n"
     "\n"
     "Command: linear  interpolate channels without debayering\n"
+    "         merge   merge the two frames into the raw EXR array\n"
     "         ssdd     self-similarity-driven debayering\n"
     "         db      Duran-Buades debayering\n"
     "\n",
@@ -32,28 +32,21 @@ using namespace termcolor;
  */
 
 /**
- * @brief load the data from a TIFF image file as a float array
- *
- * The array is allocated by this function.
+ * @brief open a 16-bit grayscale TIFF image file for reading by scanlines
  *
  * @param fname the file name to read
  * @param nx, ny storage space for the image size
  *
- * @return the data array pointer, NULL if an error occured
+ * @return the TIFF structure, NULL if an error occured
  */
-float *read_tiff_gray16_f32(const char *fname, size_t *nx, size_t *ny, char **description)
+TIFF *open_tiff_gray16(const char *fname, size_t *nx, size_t *ny, char **description)
 {
   TIFF *fp = NULL;
   uint32 width = 0,
          height = 0;
   char *c = NULL;
   uint32 config;
-  uint32 row;
-  uint32 i;
-  tdata_t buf = NULL;
-  uint16 s, nsamples;
-  float *data = NULL;
-  float *ptr_r, *ptr_g, *ptr_b;
+  uint16 nsamples;
 
   /* no warning messages */
   (void) TIFFSetWarningHandler(NULL);
@@ -62,13 +55,11 @@ float *read_tiff_gray16_f32(const char *fname, size_t *nx, size_t *ny, char **de
   if (NULL == (fp = TIFFOpen(fname, "r")))
     return NULL;
 
-  /* read width and height and allocate the storage raster */
+  /* read width and height */
   if (
     1 != TIFFGetField(fp, TIFFTAG_IMAGEWIDTH, &width) ||
     1 != TIFFGetField(fp, TIFFTAG_IMAGELENGTH, &height) ||
-    1 != TIFFGetField(fp, TIFFTAG_PLANARCONFIG, &config) ||
-    NULL == (buf = _TIFFmalloc(TIFFScanlineSize(fp))) ||
-    NULL == (data = (float *) malloc(3 * width * height * sizeof(float)))
+    1 != TIFFGetField(fp, TIFFTAG_PLANARCONFIG, &config)
   ) {
     TIFFClose(fp);
     return NULL;
@@ -102,23 +93,179 @@ float *read_tiff_gray16_f32(const char *fname, size_t *nx, size_t *ny, char **de
     exit(EXIT_FAILURE);
   }
 
+  return fp;
+}
+
+/**
+ * @brief read one scanline of a file opened by open_tiff_gray16()
+ *
+ * @param buf storage for the row, at least TIFFScanlineSize(fp) bytes
+ *
+ * @return 0 if OK, != 0 if an error occured
+ */
+int read_tiff_gray16_row(TIFF *fp, size_t row, uint16 *buf)
+{
+  return 1 == TIFFReadScanline(fp, buf, (uint32) row, 0) ? 0 : -1;
+}
+
+/**
+ * @brief load the data from a TIFF image file as a 16-bit array
+ *
+ * The array is allocated by this function, to be freed with delete[].
+ *
+ * @param fname the file name to read
+ * @param nx, ny storage space for the image size
+ *
+ * @return the data array pointer, NULL if an error occured
+ */
+uint16 *read_tiff_gray16(const char *fname, size_t *nx, size_t *ny, char **description)
+{
+  TIFF *fp = NULL;
+  size_t width = 0,
+         height = 0;
+  uint16 *buf = NULL;
+  uint16 *data = NULL;
+
+  if (NULL == (fp = open_tiff_gray16(fname, &width, &height, description)))
+    return NULL;
+
+  if (NULL == (buf = (uint16 *) _TIFFmalloc(TIFFScanlineSize(fp)))) {
+    TIFFClose(fp);
+    return NULL;
+  }
+  data = new uint16[width * height];
+
+  for (size_t row = 0; row < height; row++) {
+    if (0 != read_tiff_gray16_row(fp, row, buf)) {
+      delete[] data;
+      data = NULL;
+      break;
+    }
+    memcpy(data + row * width, buf, width * sizeof(uint16));
+  }
+
+  _TIFFfree(buf);
+  TIFFClose(fp);
+
+  if (NULL != nx)
+    *nx = width;
+  if (NULL != ny)
+    *ny = height;
+
+  return data;
+}
+
+/**
+ * @brief load an input frame as a 16-bit array, or exit
+ *
+ * The frame is announced on stderr under label. Its description is not
+ * kept.
+ *
+ * @param fname the file name to read
+ * @param nx, ny storage space for the image size
+ *
+ * @return the data array pointer, to be freed with delete[]
+ */
+uint16 *read_tiff_gray16_frame(const char *label, const char *fname, size_t *nx, size_t *ny)
+{
+  uint16 *frame;
+
+  cerr << grey << label << ": " << white << fname << reset << endl;
+  if (NULL == (frame = read_tiff_gray16(fname, nx, ny, NULL))) {
+    cerr << on_red << "error while reading from " << fname << reset << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  return frame;
+}
+
+/**
+ * @brief load the two frames of an EXR image, or exit
+ *
+ * The frames must have identical geometry (see check_frame_geometry()).
+ *
+ * @param fname0, fname1 the file names to read
+ * @param frame0, frame1 storage for the data array pointers
+ * @param nx, ny storage space for the image size
+ */
+void read_tiff_gray16_frames(const char *fname0, const char *fname1, uint16 **frame0, uint16 **frame1, size_t *nx, size_t *ny)
+{
+  size_t nx1 = 0, ny1 = 0;
+
+  *frame0 = read_tiff_gray16_frame("input file 0", fname0, nx, ny);
+  *frame1 = read_tiff_gray16_frame("input file 1", fname1, &nx1, &ny1);
+  check_frame_geometry(*nx, *ny, nx1, ny1);
+}
+
+/**
+ * @brief exit unless two frames have the same size
+ */
+void check_frame_geometry(size_t nx0, size_t ny0, size_t nx1, size_t ny1)
+{
+  if (nx0 != nx1 || ny0 != ny1) {
+    cerr << on_red << "Input frames must have identical geometry. Got "
+      << bold << nx0 << reset << on_red << "×" << bold << ny0 << reset
+      << on_red << " and "
+      << bold << nx1 << reset << on_red << "×" << bold << ny1 << reset
+      << endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * @brief load the data from a TIFF image file as a float array
+ *
+ * The array is allocated by this function.
+ *
+ * @param fname the file name to read
+ * @param nx, ny storage space for the image size
+ *
+ * @return the data array pointer, NULL if an error occured
+ */
+float *read_tiff_gray16_f32(const char *fname, size_t *nx, size_t *ny, char **description)
+{
+  TIFF *fp = NULL;
+  size_t width = 0,
+         height = 0;
+  size_t row;
+  size_t i;
+  uint16 *buf = NULL;
+  float *data = NULL;
+  float *ptr_r, *ptr_g, *ptr_b;
+
+  if (NULL == (fp = open_tiff_gray16(fname, &width, &height, description)))
+    return NULL;
+
+  /* allocate the storage raster */
+  if (
+    NULL == (buf = (uint16 *) _TIFFmalloc(TIFFScanlineSize(fp))) ||
+    NULL == (data = (float *) malloc(3 * width * height * sizeof(float)))
+  ) {
+    if (buf) _TIFFfree(buf);
+    TIFFClose(fp);
+    return NULL;
+  }
+
+  if (NULL != nx)
+    *nx = width;
+  if (NULL != ny)
+    *ny = height;
+
   /* setup the pointers */
   ptr_r = data;
   ptr_g = ptr_r + width * height;
   ptr_b = ptr_g + width * height;
 
   /*
-   * Deinterlace the TIFF raster into three arrays (ptr_r, ptr_g, ptr_b)
+   * Copy the grayscale raster into three arrays (ptr_r, ptr_g, ptr_b)
    */
 
-  for (s = 0; s < nsamples; s++) {
-    for (row = 0; row < height; row++) {
-      TIFFReadScanline(fp, buf, row, s);
-      for (i = 0; i < width; i++) {
-        *ptr_r++ = (float) ((uint16 *)buf)[i];
-        *ptr_g++ = (float) ((uint16 *)buf)[i];
-        *ptr_b++ = (float) ((uint16 *)buf)[i];
-      }
+  for (row = 0; row < height; row++) {
+    read_tiff_gray16_row(fp, row, buf);
+    for (i = 0; i < width; i++) {
+      *ptr_r++ = (float) buf[i];
+      *ptr_g++ = (float) buf[i];
+      *ptr_b++ = (float) buf[i];
     }
   }
 
@@ -230,3 +377,52 @@ int write_tiff_rgb_f32(const char *fname, const float *data, size_t nx, size_t n
 
   return retval;
 }
+
+
+/**
+ * @brief save a 16-bit grayscale array into an uncompressed TIFF file
+ *
+ * @param fname TIFF file name
+ * @param data input array
+ * @param nx ny array size
+ * @param description image description, or NULL
+ *
+ * @return 0 if OK, != 0 if an error occured
+ */
+int write_tiff_gray16(const char *fname, const uint16 *data, size_t nx, size_t ny, const char *description) {
+  TIFF *fp = NULL;
+  int retval = 0;
+
+  if (NULL == data || 4294967295. < (double) nx || 4294967295. < (double) ny)
+    return -1;
+
+  /* open the TIFF file and structure */
+  if (NULL == (fp = TIFFOpen(fname, "w")))
+    return -1;
+
+  /* insert tags into the TIFF structure */
+  if (1 != TIFFSetField(fp, TIFFTAG_IMAGEWIDTH, nx)
+    || 1 != TIFFSetField(fp, TIFFTAG_IMAGELENGTH, ny)
+    || 1 != TIFFSetField(fp, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT)
+    || 1 != TIFFSetField(fp, TIFFTAG_BITSPERSAMPLE, 16)
+    || 1 != TIFFSetField(fp, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG)
+    || 1 != TIFFSetField(fp, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(fp, nx))
+    || 1 != TIFFSetField(fp, TIFFTAG_SAMPLESPERPIXEL, 1)
+    || 1 != TIFFSetField(fp, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK)
+    || (NULL != description && 1 != TIFFSetField(fp, TIFFTAG_IMAGEDESCRIPTION, description))
+  ) {
+    TIFFClose(fp);
+    return -1;
+  }
+
+  for (size_t row = 0; row < ny; row++) {
+    if (TIFFWriteScanline(fp, (void *)&data[row * nx], row, 0) < 0) {
+      retval = -1;
+      break;
+    }
+  }
+
+  TIFFClose(fp);
+
+  return retval;
+}
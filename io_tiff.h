@@ -35,8 +35,15 @@
 #include <tiffio.h>
 
 
+TIFF *open_tiff_gray16(const char *fname, size_t *nx, size_t *ny, char **description);
+int read_tiff_gray16_row(TIFF *fp, size_t row, uint16 *buf);
+uint16 *read_tiff_gray16(const char *fname, size_t *nx, size_t *ny, char **description);
+uint16 *read_tiff_gray16_frame(const char *label, const char *fname, size_t *nx, size_t *ny);
+void read_tiff_gray16_frames(const char *fname0, const char *fname1, uint16 **frame0, uint16 **frame1, size_t *nx, size_t *ny);
+void check_frame_geometry(size_t nx0, size_t ny0, size_t nx1, size_t ny1);
 float *read_tiff_gray16_f32(const char *fname, size_t *nx, size_t *ny, char **description);
 int write_tiff_rgb_f32(const char *fname, const float *data, size_t nx, size_t ny);
+int write_tiff_gray16(const char *fname, const uint16 *data, size_t nx, size_t ny, const char *description);
 
 
 
@@ -21,6 +21,8 @@
 */
 
 
+#include <algorithm>
+
 #include "libAuxiliary.h"
 
 #include "io_tiff.h"
@@ -38,6 +40,14 @@
 
 
 
+// YUV of pixel i
+static inline void rgb2yuv(const float *r, const float *g, const float *b, float *Y, float *U, float *V, int i) {
+  Y[i] = (COEFF_YR * r[i] + COEFF_YG * g[i] + COEFF_YB * b[i]);
+  U[i] = (r[i] - Y[i]);
+  V[i] = (b[i] - Y[i]);
+}
+
+
 /**
  * \brief  RGV to YUV standard conversion
  *
@@ -60,27 +70,30 @@ void wxRgb2Yuv(
   int origWidth,
   int origHeight
 ) {
+  #pragma omp parallel for schedule(static)
   for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      int i = y * width + x;
-      if (
-        x + y >= origWidth - 1 &&                   // NW boundary
-        y > x - origWidth - 1 &&                    // NE boundary
-        x + y < origWidth + 2 * origHeight - 1 &&   // SE boundary
-        x > y - origWidth                           // SW boundary
-      ) {
-        Y[i] = (COEFF_YR * r[i] + COEFF_YG * g[i] + COEFF_YB * b[i]);
-        U[i] = (r[i] - Y[i]);
-        V[i] = (b[i] - Y[i]);
-      }
-      else {
-        Y[i] = U[i] = V[i] = 0;
-      }
+    int xa, xb;
+    exr_row_span(y, width, origWidth, origHeight, &xa, &xb);
+
+    for (int i = y * width; i < y * width + xa; i++) Y[i] = U[i] = V[i] = 0;
+    for (int i = y * width + xb; i < (y + 1) * width; i++) Y[i] = U[i] = V[i] = 0;
+
+    for (int i = y * width + xa; i < y * width + xb; i++) {
+      rgb2yuv(r, g, b, Y, U, V, i);
     }
   }
 }
 
 
+// The same for a whole rectangular image of dim pixels
+void wxRgb2Yuv(float *r, float *g, float *b, float *Y, float *U, float *V, int dim) {
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < dim; i++) {
+    rgb2yuv(r, g, b, Y, U, V, i);
+  }
+}
+
+
 /**
  * \brief   YUV to RGB standard conversion
  *
@@ -117,6 +130,20 @@ void wxCopy(float *tpI, float *tpO, int ilength) {
 
 
 
+float *canvas_alloc(size_t width, size_t height, int planes) {
+  size_t ghost = CANVAS_GHOST * (width + 1);
+  float *block = (float *) calloc(width * height * planes + 2 * ghost, sizeof(float));
+
+  return block ? block + ghost : NULL;
+}
+
+
+void canvas_free(float *canvas, size_t width) {
+  if (canvas) free(canvas - CANVAS_GHOST * (width + 1));
+}
+
+
+
 /**
  * \brief Tabulate Exp(-x)
  *
@@ -219,6 +246,220 @@ float l2_distance_r1(
 }
 
 
+/**
+ * \brief  Build a pruned median network for n samples
+ *
+ *
+ * @param[out]  net  network
+ * @param[in]   n    number of samples (at most MEDIAN_NETWORK_MAX)
+ *
+ */
+void median_network_init(median_network *net, int n) {
+  int wires = 1;
+  while (wires < n) wires <<= 1;
+
+  // Batcher odd-even merge sort on n samples padded with +infinity.
+  // Comparators against a padding wire reduce to nothing or to a swap,
+  // which is done by renaming the wires instead.
+  int row[MEDIAN_NETWORK_WIRES];  // lane row holding each wire
+  bool pad[MEDIAN_NETWORK_WIRES];
+  for (int w = 0; w < wires; w++) {
+    row[w] = w;
+    pad[w] = w >= n;
+  }
+
+  int ncomp = 0;
+  unsigned char lo[MEDIAN_NETWORK_COMPARATORS];
+  unsigned char hi[MEDIAN_NETWORK_COMPARATORS];
+  for (int p = 1; p < wires; p <<= 1) {
+    for (int k = p; k >= 1; k >>= 1) {
+      for (int j = k % p; j + k < wires; j += 2 * k) {
+        for (int i = 0; i < k && i + j + k < wires; i++) {
+          int a = i + j, b = i + j + k;
+          if ((i + j) / (2 * p) != (i + j + k) / (2 * p) || pad[b]) continue;
+          if (pad[a]) {
+            std::swap(row[a], row[b]);
+            std::swap(pad[a], pad[b]);
+            continue;
+          }
+          lo[ncomp] = row[a];
+          hi[ncomp] = row[b];
+          ncomp++;
+        }
+      }
+    }
+  }
+
+  // Walk back from the median row, keeping only the comparator outputs
+  // it depends on.
+  bool live[MEDIAN_NETWORK_WIRES] = {false};
+  unsigned char keep[MEDIAN_NETWORK_COMPARATORS];
+  live[row[n / 2]] = true;
+  for (int c = ncomp - 1; c >= 0; c--) {
+    keep[c] = (live[lo[c]] ? 1 : 0) | (live[hi[c]] ? 2 : 0);
+    if (keep[c]) {
+      live[lo[c]] = live[hi[c]] = true;
+    }
+  }
+
+  net->n = n;
+  net->out = row[n / 2];
+  net->ncomp = 0;
+  for (int c = 0; c < ncomp; c++) {
+    if (keep[c]) {
+      net->lo[net->ncomp] = lo[c];
+      net->hi[net->ncomp] = hi[c];
+      net->keep[net->ncomp] = keep[c];
+      net->ncomp++;
+    }
+  }
+}
+
+
+
+/**
+ * \brief  Apply a median network to a block of lanes
+ *
+ *
+ * @param[in]      net     network built by median_network_init()
+ * @param[in,out]  lanes   sample k of lane t at lanes[k * MEDIAN_LANES + t]
+ * @param[in]      nlanes  number of lanes in use
+ *
+ */
+void median_network_run(const median_network *net, float *lanes, int nlanes) {
+  for (int c = 0; c < net->ncomp; c++) {
+    float *a = lanes + net->lo[c] * MEDIAN_LANES;
+    float *b = lanes + net->hi[c] * MEDIAN_LANES;
+    switch (net->keep[c]) {
+      case 1:
+        for (int t = 0; t < nlanes; t++) a[t] = fminf(a[t], b[t]);
+        break;
+      case 2:
+        for (int t = 0; t < nlanes; t++) b[t] = fmaxf(a[t], b[t]);
+        break;
+      default:
+        for (int t = 0; t < nlanes; t++) {
+          float u = a[t], v = b[t];
+          a[t] = fminf(u, v);
+          b[t] = fmaxf(u, v);
+        }
+    }
+  }
+}
+
+
+
+/**
+ * \brief  Tabulate the circular footprint of a median filter
+ *
+ *
+ * @param[out]  fp       footprint
+ * @param[in]   fRadius  radius of the disc
+ *
+ */
+void median_footprint_init(median_footprint *fp, float fRadius) {
+  int iRadius = (int)(fRadius + 1.0);
+  int iNeigSize = (2 * iRadius + 1) * (2 * iRadius + 1);
+  float fRadiusSqr = fRadius * fRadius;
+
+  fp->radius = iRadius;
+  fp->dx = new int[iNeigSize];
+  fp->dy = new int[iNeigSize];
+  fp->n = 0;
+  for (int i = -iRadius; i <= iRadius; i++) {
+    for (int j= -iRadius; j <= iRadius; j++) {
+      if ((float)(i * i + j * j) <= fRadiusSqr) {
+        fp->dx[fp->n] = i;
+        fp->dy[fp->n] = j;
+        fp->n++;
+      }
+    }
+  }
+
+  fp->network = fp->n <= MEDIAN_NETWORK_MAX;
+  if (fp->network) {
+    median_network_init(&fp->net, fp->n);
+  }
+}
+
+
+
+void median_footprint_free(median_footprint *fp) {
+  delete[] fp->dx;
+  delete[] fp->dy;
+}
+
+
+
+/**
+ * \brief  Median filter one canvas row
+ *
+ *
+ * @param[in]   fp      footprint
+ * @param[in]   center  row y of the input; rows y - radius .. y + radius that
+ *                      fall on the canvas must be readable at a stride of width
+ * @param[out]  out     row y of the output; only xa .. xb - 1 are written
+ * @param[in]   y       canvas row
+ * @param[in]   width, height  canvas size
+ * @param[in]   xa, xb  span of pixels to filter
+ * @param       lanes   scratch of fp->n * MEDIAN_LANES floats (network footprints only)
+ * @param       vector  scratch of fp->n floats
+ *
+ */
+void median_row(
+  const median_footprint *fp,
+  const float *center,
+  float *out,
+  int y,
+  int width,
+  int height,
+  int xa,
+  int xb,
+  float *lanes,
+  float *vector
+) {
+  // Pixels whose footprint lies entirely inside the canvas go through the
+  // network, MEDIAN_LANES at a time.
+  int xi = MAX(xa, fp->radius);
+  int xj = MIN(xb, width - fp->radius);
+  if (not fp->network or y < fp->radius or y >= height - fp->radius or xi > xj) {
+    xi = xj = xb;
+  }
+
+  for (int x0 = xi; x0 < xj; x0 += MEDIAN_LANES) {
+    int count = MIN(MEDIAN_LANES, xj - x0);
+    for (int k = 0; k < fp->n; k++) {
+      memcpy(lanes + k * MEDIAN_LANES, center + fp->dy[k] * width + x0 + fp->dx[k], count * sizeof(float));
+    }
+    median_network_run(&fp->net, lanes, count);
+    memcpy(out + x0, lanes + fp->net.out * MEDIAN_LANES, count * sizeof(float));
+  }
+
+  // Take spatial neighborhood where the footprint is clipped by the canvas
+  for (int x = xa; x < xb; x++) {
+    if (x == xi) x = xj;
+    if (x == xb) break;
+
+    int iCount = 0;
+    for (int k = 0; k < fp->n; k++) {
+      int xn = x + fp->dx[k];
+      int yn = y + fp->dy[k];
+
+      if (xn >= 0 && yn >= 0 && xn < width && yn < height) {
+        vector[iCount] = center[fp->dy[k] * width + xn];
+        iCount++;
+      }
+    }
+
+    // order neighborhood values
+    QuickSortFloat(vector, iCount);
+
+    out[x] = vector[iCount / 2];
+  }
+}
+
+
+
 /**
  * \brief  Sliding window iterated median filter
  *
@@ -240,59 +481,230 @@ void wxMedian(
   int origWidth,
   int origHeight
 ) {
-  int iRadius = (int)(fRadius + 1.0);
-  int iNeigSize = (2 * iRadius + 1) * (2 * iRadius + 1);
-  float fRadiusSqr = fRadius * fRadius;
-
-
-  // Vector to store the values of each pixel's neighborhood
-  float *vector = new float[iNeigSize];
+  median_footprint fp;
+  median_footprint_init(&fp, fRadius);
 
   // For each iteration
   for(int n = 0; n < inIter; n++) {
 
-    // For each pixel
-    for (int x = 0; x < iWidth; x++) {
+    #pragma omp parallel
+    {
+      // Per-thread neighborhood values and network lanes
+      float *vector = new float[fp.n];
+      float *lanes = new float[fp.n * MEDIAN_LANES];
+
+      // For each row, in bands of MEDIAN_BAND rows
+      #pragma omp for schedule(dynamic, MEDIAN_BAND)
       for (int y = 0; y < iHeight; y++) {
-        int i = y * iWidth + x;
-        if (
-            x + y >= origWidth - 1 &&                   // NW boundary
-            y > x - origWidth - 1 &&                    // NE boundary
-            x + y < origWidth + 2 * origHeight - 1 &&   // SE boundary
-            x > y - origWidth                           // SW boundary
-           ) {
-
-          // Take spatial neighborhood of radius fRadius
-          int iCount = 0;
-          for (int i = -iRadius; i <= iRadius; i++) {
-            for (int j= -iRadius; j <= iRadius; j++) {
-              if ((float)(i * i + j * j) <= fRadiusSqr) {
-                int x0 = x + i;
-                int y0 = y + j;
-
-                if (x0 >= 0 && y0 >= 0 && x0 < iWidth && y0 < iHeight) {
-                  vector[iCount] = input[y0 * iWidth + x0];
-                  iCount++;
-                }
-              }
-            }
-          }
+        int xa, xb;
+        exr_row_span(y, iWidth, origWidth, origHeight, &xa, &xb);
 
-          // order neighborhood values
-          QuickSortFloat(vector, iCount);
+        for (int x = 0; x < xa; x++) output[y * iWidth + x] = 0;
+        for (int x = xb; x < iWidth; x++) output[y * iWidth + x] = 0;
 
-          output[y * iWidth + x] = vector[iCount / 2];
+        median_row(&fp, input + y * iWidth, output + y * iWidth, y, iWidth, iHeight, xa, xb, lanes, vector);
+      }
+
+      delete[] vector;
+      delete[] lanes;
+    }
+
+    wxCopy(output, input, iWidth * iHeight);
+  }
+
+  median_footprint_free(&fp);
+}
+
+
+
+/**
+ * \brief  Constant-time median filter on a square window
+ *
+ * Perreault and Hébert's sliding histogram median: values are quantised to
+ * HIST_BINS levels between the plane minimum and maximum, each column keeps
+ * a histogram of the 2·radius + 1 rows around the current one, and the
+ * window histogram slides along the row by adding one column histogram and
+ * subtracting another. The window histogram is kept in two tiers: the coarse
+ * tier is updated at every step, and the fine tier of a coarse bin only when
+ * the median falls into it.
+ *
+ * Columns are processed in parallel strips of HIST_STRIP by
+ * median_histogram_row(). Values are quantised as their row enters and
+ * leaves the column histograms, so no plane of levels is kept.
+ *
+ * @param[in]   input  input image
+ * @param[out]  output  output image, quantised to HIST_BINS levels
+ * @param[in]   radius  window of size (2*radius+1) x (2*radius+1)
+ * @param[in]   iWidth, iHeight size of the image
+ * @param[in]   spanA, spanB  row y is filtered for spanA[y] <= x < spanB[y]
+ *                            and zero elsewhere
+ *
+ */
+void wxMedianHistogram(
+  float *input,
+  float *output,
+  int radius,
+  int iWidth,
+  int iHeight,
+  const int *spanA,
+  const int *spanB
+) {
+  long size = (long)iWidth * iHeight;
+
+  // Quantisation range
+  float lo = input[0], hi = input[0];
+  #pragma omp parallel for reduction(min:lo) reduction(max:hi)
+  for (long i = 0; i < size; i++) {
+    lo = fminf(lo, input[i]);
+    hi = fmaxf(hi, input[i]);
+  }
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int xs = 0; xs < iWidth; xs += HIST_STRIP) {
+    int xe = MIN(xs + HIST_STRIP, iWidth);
+    median_histogram mh;
+    median_histogram_init(&mh, radius, iWidth, iHeight, lo, hi, xs, xe);
+
+    for (int y = -radius; y < iHeight; y++) {
+      // Slide the column histograms down to rows y - radius .. y + radius
+      if (y + radius < iHeight) {
+        median_histogram_add(&mh, input + (long)(y + radius) * iWidth, 1);
+      }
+      if (y - radius - 1 >= 0) {
+        median_histogram_add(&mh, input + (long)(y - radius - 1) * iWidth, -1);
+      }
+      if (y < 0) continue;
+
+      int xa = MAX(spanA[y], xs);
+      int xb = MAX(MIN(spanB[y], xe), xa);
+      float *out = output + (long)y * iWidth;
+
+      for (int x = xs; x < xa; x++) out[x] = 0;
+      for (int x = xb; x < xe; x++) out[x] = 0;
+      median_histogram_row(&mh, y, xa, xb, out);
+    }
+
+    median_histogram_free(&mh);
+  }
+}
+
+
+
+void median_histogram_init(median_histogram *mh, int radius, int width, int height, float lo, float hi, int xs, int xe) {
+  mh->radius = radius;
+  mh->width = width;
+  mh->height = height;
+  mh->lo = lo;
+  mh->scale = hi > lo ? (HIST_BINS - 1) / (hi - lo) : 0;
+  mh->ca = MAX(xs - radius, 0);
+  mh->cb = MIN(xe + radius, width);
+  mh->colFine = new unsigned short[(mh->cb - mh->ca) * HIST_BINS]();
+  mh->colCoarse = new unsigned short[(mh->cb - mh->ca) * HIST_COARSE]();
+}
+
+
+
+void median_histogram_free(median_histogram *mh) {
+  delete[] mh->colFine;
+  delete[] mh->colCoarse;
+}
+
+
+
+void median_histogram_add(median_histogram *mh, const float *row, int delta) {
+  for (int c = mh->ca; c < mh->cb; c++) {
+    unsigned short l = (unsigned short)((row[c] - mh->lo) * mh->scale + 0.5f);
+    mh->colFine[(c - mh->ca) * HIST_BINS + l] += delta;
+    mh->colCoarse[(c - mh->ca) * HIST_COARSE + l / HIST_FINE] += delta;
+  }
+}
+
+
+
+void median_histogram_row(const median_histogram *mh, int y, int xa, int xb, float *out) {
+  int radius = mh->radius, iWidth = mh->width, iHeight = mh->height, ca = mh->ca;
+  float lo = mh->lo, scale = mh->scale;
+  const unsigned short *colFine = mh->colFine, *colCoarse = mh->colCoarse;
+
+  // Window histogram; the fine tier of coarse bin c is valid at column fineX[c]
+  unsigned coarse[HIST_COARSE];
+  unsigned fine[HIST_COARSE][HIST_FINE];
+  int fineX[HIST_COARSE];
+
+  if (xa >= xb) return;
+
+  int rows = MIN(y + radius, iHeight - 1) - MAX(y - radius, 0) + 1;
+
+  // Window histogram at the start of the span
+  memset(coarse, 0, sizeof(coarse));
+  for (int c = MAX(xa - radius, 0); c <= MIN(xa + radius, iWidth - 1); c++) {
+    for (int k = 0; k < HIST_COARSE; k++) coarse[k] += colCoarse[(c - ca) * HIST_COARSE + k];
+  }
+  for (int k = 0; k < HIST_COARSE; k++) fineX[k] = -1;
+
+  for (int x = xa; x < xb; x++) {
+    if (x > xa) {
+      if (x + radius < iWidth) {
+        const unsigned short *h = colCoarse + (x + radius - ca) * HIST_COARSE;
+        for (int k = 0; k < HIST_COARSE; k++) coarse[k] += h[k];
+      }
+      if (x - radius - 1 >= 0) {
+        const unsigned short *h = colCoarse + (x - radius - 1 - ca) * HIST_COARSE;
+        for (int k = 0; k < HIST_COARSE; k++) coarse[k] -= h[k];
+      }
+    }
+
+    int cols = MIN(x + radius, iWidth - 1) - MAX(x - radius, 0) + 1;
+    unsigned rank = (unsigned)(rows * cols) / 2;
+
+    // Coarse bin holding the median
+    unsigned below = 0;
+    int c = 0;
+    while (below + coarse[c] <= rank) below += coarse[c++];
+
+    // Bring its fine tier up to column x
+    if (fineX[c] < 0 or x - fineX[c] > 2 * radius) {
+      memset(fine[c], 0, sizeof(fine[c]));
+      for (int col = MAX(x - radius, 0); col <= MIN(x + radius, iWidth - 1); col++) {
+        const unsigned short *h = colFine + (col - ca) * HIST_BINS + c * HIST_FINE;
+        for (int k = 0; k < HIST_FINE; k++) fine[c][k] += h[k];
+      }
+    }
+    else {
+      for (int xx = fineX[c] + 1; xx <= x; xx++) {
+        if (xx + radius < iWidth) {
+          const unsigned short *h = colFine + (xx + radius - ca) * HIST_BINS + c * HIST_FINE;
+          for (int k = 0; k < HIST_FINE; k++) fine[c][k] += h[k];
         }
-        else {
-          output[i] = 0;
+        if (xx - radius - 1 >= 0) {
+          const unsigned short *h = colFine + (xx - radius - 1 - ca) * HIST_BINS + c * HIST_FINE;
+          for (int k = 0; k < HIST_FINE; k++) fine[c][k] -= h[k];
         }
       }
     }
+    fineX[c] = x;
 
-    wxCopy(output, input, iWidth * iHeight);
+    int f = 0;
+    while (below + fine[c][f] <= rank) below += fine[c][f++];
+
+    out[x] = scale > 0 ? lo + (c * HIST_FINE + f) / scale : lo;
   }
+}
+
+
+
+// The same on a canvas, filtered inside the diamond
+void wxMedianHistogram(float *input, float *output, int radius, int iWidth, int iHeight, int origWidth, int origHeight) {
+  int *spanA = new int[iHeight];
+  int *spanB = new int[iHeight];
+  for (int y = 0; y < iHeight; y++) {
+    exr_row_span(y, iWidth, origWidth, origHeight, spanA + y, spanB + y);
+  }
+
+  wxMedianHistogram(input, output, radius, iWidth, iHeight, spanA, spanB);
 
-  delete[] vector;
+  delete[] spanA;
+  delete[] spanB;
 }
 
 
@@ -43,6 +43,77 @@
 
 #define fTiny 0.00000001f
 
+#define MEDIAN_BAND 16   // rows per work item of the parallel median
+
+
+/**
+ * \brief  Span of a canvas row inside the tilted EXR diamond
+ *
+ * The diamond is the set of pixels satisfying
+ *
+ *   x + y >= origWidth - 1                    (NW boundary)
+ *   y > x - origWidth - 1                     (NE boundary)
+ *   x + y < origWidth + 2 * origHeight - 1    (SE boundary)
+ *   x > y - origWidth                         (SW boundary)
+ *
+ * @param[in]   y  canvas row
+ * @param[in]   width  canvas width
+ * @param[in]   origWidth, origHeight  size of the sensor frame
+ * @param[out]  xa, xb  the row is inside for xa <= x < xb (empty if xa >= xb)
+ *
+ */
+
+static inline void exr_row_span(int y, int width, int origWidth, int origHeight, int *xa, int *xb) {
+  *xa = MAX(0, MAX(origWidth - 1 - y, y - origWidth + 1));
+  *xb = MIN(width, MIN(y + origWidth + 1, origWidth + 2 * origHeight - 1 - y));
+  if (*xb < *xa) *xb = *xa;
+}
+
+
+/**
+ * \brief  Mirrored ghost cell of a rectangular plane
+ *
+ * Index -1 reads 1 and index n reads n - 2, so the reflected site keeps
+ * its Bayer phase and the interior stencils apply unchanged on the edges.
+ *
+ * @param[in]  i  row or column index, -1 <= i <= n
+ * @param[in]  n  number of rows or columns (at least 2)
+ *
+ */
+
+static inline int mirror_index(int i, int n) {
+  return i < 0 ? -i : (i >= n ? 2 * n - 2 - i : i);
+}
+
+
+#define CANVAS_GHOST 2   // ghost rows (and cells) on either side of a canvas plane stack
+
+/**
+ * \brief  Allocate a zero-set stack of canvas planes with ghost rows
+ *
+ * The EXR stencils reach two rows and two columns past the pixel they
+ * interpolate. Inside the canvas, the blank area around the diamond serves
+ * as their margin, but at the north and south corners of the diamond they
+ * would leave the allocation. CANVAS_GHOST blank rows (plus CANVAS_GHOST
+ * cells) before the first plane and after the last one give them the same
+ * blank surroundings as anywhere else, so no edge rule has to test the
+ * canvas bounds.
+ *
+ * @param[in]  width, height  size of a plane
+ * @param[in]  planes  number of planes
+ * @return  pointer to the first plane, or NULL if out of memory
+ *
+ */
+
+float *canvas_alloc(size_t width, size_t height, int planes);
+
+/**
+ * \brief  Free a plane stack allocated by canvas_alloc()
+ *
+ */
+
+void canvas_free(float *canvas, size_t width);
+
 
 #define COEFF_YR 0.299
 #define COEFF_YG 0.587
@@ -65,6 +136,9 @@
 
 void wxRgb2Yuv(float *r,float *g,float *b,float *y,float *u,float *v,int width,int height, int origWidth, int origHeight);
 
+// The same for a whole rectangular image of dim pixels
+void wxRgb2Yuv(float *r, float *g, float *b, float *y, float *u, float *v, int dim);
+
 
 
 /**
@@ -150,12 +224,170 @@ float sLUT(float dif,float *lut);
  * @param[in]  fRadius window of size (2*fRadius+1) x (2*fRadius+1)
  * @param[in]  iWidth, iHeight size of the image
  *
+ * Footprints of up to MEDIAN_NETWORK_MAX samples are filtered by a median
+ * network wherever they fit the canvas, larger ones by sorting. Rows are
+ * processed in parallel, in bands of MEDIAN_BAND rows.
+ *
  */
 
 void wxMedian(float *u,float *v, float fRadius, int inIter, int iWidth,int iHeight, int origWidth, int origHeight);
 
 
 
+/**
+ * \brief  Median selection network for small fixed footprints
+ *
+ * A Batcher odd-even merge sorting network on n samples, pruned to the
+ * comparators (or their min or max halves) that feed the median. It is
+ * applied to MEDIAN_LANES neighbouring pixels at a time, each sample being
+ * a row of lanes, so every comparator is a branch-free, vectorisable
+ * min/max over the lanes.
+ *
+ */
+
+#define MEDIAN_NETWORK_MAX 25     // largest footprint handled by the network
+#define MEDIAN_NETWORK_WIRES 32   // MEDIAN_NETWORK_MAX padded to a power of two
+#define MEDIAN_NETWORK_COMPARATORS 256
+#define MEDIAN_LANES 64
+
+struct median_network {
+  int n;                                          // number of samples
+  int out;                                        // lane row receiving the median
+  int ncomp;                                      // number of comparators
+  unsigned char lo[MEDIAN_NETWORK_COMPARATORS];   // lane row receiving the min
+  unsigned char hi[MEDIAN_NETWORK_COMPARATORS];   // lane row receiving the max
+  unsigned char keep[MEDIAN_NETWORK_COMPARATORS]; // 1: min is used, 2: max is used, 3: both
+};
+
+void median_network_init(median_network *net, int n);
+
+/**
+ * \brief  Apply a median network to a block of lanes
+ *
+ * @param[in]      net     network built by median_network_init()
+ * @param[in,out]  lanes   sample k of lane t at lanes[k * MEDIAN_LANES + t]
+ * @param[in]      nlanes  number of lanes in use (at most MEDIAN_LANES)
+ *
+ * The medians end up in lane row net->out.
+ *
+ */
+
+void median_network_run(const median_network *net, float *lanes, int nlanes);
+
+
+
+/**
+ * \brief  Circular median footprint
+ *
+ * Samples (dx, dy) with dx² + dy² <= fRadius², in a square of half side
+ * radius, and the median network for them if they are few enough.
+ *
+ */
+
+struct median_footprint {
+  int radius;          // half side of the bounding square
+  int n;               // number of samples
+  int *dx, *dy;        // sample offsets
+  bool network;        // n <= MEDIAN_NETWORK_MAX
+  median_network net;
+};
+
+void median_footprint_init(median_footprint *fp, float fRadius);
+void median_footprint_free(median_footprint *fp);
+
+
+
+/**
+ * \brief  Median filter one canvas row
+ *
+ * Pixels whose footprint fits the canvas are filtered by the network (if
+ * any), the others by sorting the samples that fall on the canvas.
+ *
+ * @param[in]   fp      footprint
+ * @param[in]   center  row y of the input; the rows it reaches on the canvas
+ *                      must be readable at a stride of width
+ * @param[out]  out     row y of the output; only xa .. xb - 1 are written
+ * @param[in]   y       canvas row
+ * @param[in]   width, height  canvas size
+ * @param[in]   xa, xb  span of pixels to filter
+ * @param       lanes   scratch of fp->n * MEDIAN_LANES floats
+ * @param       vector  scratch of fp->n floats
+ *
+ */
+
+void median_row(
+  const median_footprint *fp,
+  const float *center,
+  float *out,
+  int y,
+  int width,
+  int height,
+  int xa,
+  int xb,
+  float *lanes,
+  float *vector
+);
+
+
+
+/**
+ * \brief  Constant-time median filter on a square window
+ *
+ * Sliding histogram median (Perreault and Hébert) over values quantised to
+ * HIST_BINS levels between the minimum and maximum of the input. The cost
+ * per pixel does not depend on the radius.
+ *
+ * @param[in]   input  input image
+ * @param[out]  output  output image
+ * @param[in]   radius  window of size (2*radius+1) x (2*radius+1)
+ * @param[in]   iWidth, iHeight size of the image
+ * @param[in]   spanA, spanB  row y is filtered for spanA[y] <= x < spanB[y]
+ *
+ */
+
+#define HIST_COARSE 64
+#define HIST_FINE 64                          // fine bins per coarse bin
+#define HIST_BINS (HIST_COARSE * HIST_FINE)
+#define HIST_STRIP 256                        // columns per work item
+
+void wxMedianHistogram(float *input, float *output, int radius, int iWidth, int iHeight, const int *spanA, const int *spanB);
+
+// The same on a canvas, filtered inside the diamond
+void wxMedianHistogram(float *input, float *output, int radius, int iWidth, int iHeight, int origWidth, int origHeight);
+
+
+
+/**
+ * \brief  Sliding histogram median over one strip of columns
+ *
+ * The engine of wxMedianHistogram(), for callers that produce the input a
+ * row at a time. The strip xs .. xe - 1 keeps the column histograms of the
+ * columns its windows reach. Rows are added as the window moves down and
+ * removed as it leaves them, and must be given the same values both times.
+ *
+ */
+
+struct median_histogram {
+  int radius;                 // window of size (2*radius+1) x (2*radius+1)
+  int width, height;          // size of the image
+  float lo, scale;            // a value v falls at the level (v - lo) * scale
+  int ca, cb;                 // columns with a histogram
+  unsigned short *colFine;    // HIST_BINS per column
+  unsigned short *colCoarse;  // HIST_COARSE per column
+};
+
+void median_histogram_init(median_histogram *mh, int radius, int width, int height, float lo, float hi, int xs, int xe);
+void median_histogram_free(median_histogram *mh);
+
+// Add (delta 1) or remove (delta -1) an image row, indexed by x
+void median_histogram_add(median_histogram *mh, const float *row, int delta);
+
+// Median of the pixels xa .. xb - 1 of row y to out[x]; the rows of its
+// window, and only those, must have been added
+void median_histogram_row(const median_histogram *mh, int y, int xa, int xb, float *out);
+
+
+
 /**
  * \brief  Standard Quicksort. Orders float array in increasing order
  *
@@ -27,19 +27,19 @@
 #include <ctime>
 #include <unistd.h>
 #include "libdemosaic.h"
+#include "exr_stencil.h"
 
 #include "progressbar.h"
 #include "io_tiff.h"
 #include "tiffio.h"
 
 
-#define BLANK 0
-#define REDPOSITION 1
-#define GREENPOSITION 2
-#define BLUEPOSITION 3
+#define RB_EDGE_BAND 6 // columns along the diamond edges left to the sequential pass of exr_red_blue()
 
-#define DIAG 1.4142136
-#define DIAG12 2.236 // sqrt(5)
+#define CHROMA_BAND 16 // rows per work item of the fused chromatic median
+#define CHROMA_GUIDE_SIGMA 1024.0f // luminance range of the half-resolution chroma guide, 16-bit units
+#define CHROMA_GUIDE_FLOOR 1e-12f // weight of the nearest cell beyond the range of the guide
+#define CHROMA_HISTOGRAM_RADIUS 3.0f // smallest radius of the chromatic median done by histograms
 
 #define DUMP_STAGES
 
@@ -52,6 +52,134 @@
  */
 
 
+/**
+ * \brief  Directional interpolation of green in the interior of an odd row
+ *
+ * The NW, N and NE candidates are all evaluated, and one of them, or their
+ * isotropic average, is selected without branches, so that the loop over x
+ * vectorizes. Red and blue pixels alternate in pairs along the row; both
+ * planes are read and the one of the pixel's color is selected.
+ *
+ */
+
+static void green_directional_row(
+  float threshold,
+  const float *ored,
+  float *ogreen,
+  const float *oblue,
+  int y,
+  int xa,
+  int xb,
+  int width
+) {
+  const float *g = ogreen + y * width;
+  const float *gn = g - width, *gs = g + width;
+  float *out = ogreen + y * width;
+
+  #pragma omp simd
+  for (int x = xa; x < xb; x++) {
+    int
+      p = y * width + x,
+      n2 = p - 2 * width,
+      s2 = p + 2 * width;
+
+    // Compute gradients in the green channel.
+    float gN = fabsf(gn[x] - gs[x]);
+    float gNW = fabsf(gn[x - 1] - gs[x + 1]) / DIAG; // diagonal distance is longer
+    float gNE = fabsf(gn[x + 1] - gs[x - 1]) / DIAG;
+
+    // Compute diagonal second derivatives in the same channel as current
+    // pixel.
+    //
+    //     NW          N           N          NE
+    //               even         odd
+    // R . . . .   . R . . .   . . . R .   . . . . R
+    // . . . . .   . . . . .   . . . . .   . . . . .
+    // . . * . .   . . * . .   . . * . .   . . * . .
+    // . . . . .   . . . . .   . . . . .   . . . . .
+    // . . . . R   . R . . .   . . . R .   R . . . .
+    //
+    // (the same for blue; both parities use the "even" N stencil)
+    //
+    // Red pairs are at phases 0 and 1 of x + y - 1 in the CFA mask
+    float wr = 1 - (((x + y - 1) & 3) >> 1), wb = 1 - wr;
+    float c = wr * ored[p] + wb * oblue[p];
+    float cnw2 = wr * ored[n2 - 2] + wb * oblue[n2 - 2];
+    float cse2 = wr * ored[s2 + 2] + wb * oblue[s2 + 2];
+    float cne2 = wr * ored[n2 + 2] + wb * oblue[n2 + 2];
+    float csw2 = wr * ored[s2 - 2] + wb * oblue[s2 - 2];
+    float cn2 = wr * ored[n2 - 1] + wb * oblue[n2 - 1];
+    float cs2 = wr * ored[s2 - 1] + wb * oblue[s2 - 1];
+    float d2nw = (2.0 * c - cnw2 - cse2) / 8.0; // (2 * DIAG) squared
+    float d2ne = (2.0 * c - cne2 - csw2) / 8.0;
+    float d2n  = (2.0 * c - cn2 - cs2) / 5.0;   // DIAG12 squared
+
+    // Add second differences to gradients
+    gNW += fabsf(d2nw);
+    gN  += fabsf(d2n);
+    gNE += fabsf(d2ne);
+
+    float gmin = fminf(gNW, fminf(gN, gNE));
+
+    // The isotropic average if all differences are similar, otherwise the
+    // average along the smoothest direction. The second differences only
+    // steer the choice; they are not added to the averages.
+    float iso =
+      (
+       gn[x - 1] / DIAG + gn[x] + gn[x + 1] / DIAG +
+       gs[x + 1] / DIAG + gs[x] + gs[x - 1] / DIAG
+      ) / (2 + 4 / DIAG);
+    float vnw = (gn[x - 1] + gs[x + 1]) / 2.0;
+    float vn = (gn[x] + gs[x]) / 2.0;
+    float vne = (gn[x + 1] + gs[x - 1]) / 2.0;
+
+    float spread = fmaxf(fabsf(gNW - gmin), fmaxf(fabsf(gN - gmin), fabsf(gNE - gmin)));
+
+    float o = out[x];
+    float v = gmin == gNE ? vne : o;
+    v = gmin == gN ? vn : v;
+    v = gmin == gNW ? vnw : v;
+    out[x] = spread < threshold ? iso : v;
+  }
+}
+
+
+void exr_green_edges_row(
+  float *ogreen,
+  const unsigned char *mask,
+  int y,
+  int width,
+  int origWidth,
+  int origHeight
+) {
+  int xa, xb, ia, ib;
+  exr_row_span(y, width, origWidth, origHeight, &xa, &xb);
+  exr_green_interior(y, xa, xb, origWidth, origHeight, &ia, &ib);
+
+  for (int x = xa; x < xb; x++) {
+    if (x == ia) x = ib;
+    if (x == xb) break;
+    ogreen[x] = exr_green_edge(ogreen, mask, x, width);
+  }
+}
+
+
+void exr_green_edges(
+  float *ogreen,
+  int width,
+  int height,
+  int origWidth,
+  int origHeight,
+  unsigned char *mask
+) {
+  // Only green sites are read, so rows are independent.
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int y = 1; y < height; y += 2) {
+    exr_green_edges_row(ogreen + y * width, mask + y * width, y, width, origWidth, origHeight);
+  }
+}
+
+
 /**
  * \brief  Classical Adams-Hamilton demosaicking algorithm (adapted for Fuji EXR)
  *
@@ -90,207 +218,25 @@ void g_directional (
 
   // Interpolate the green channel in the 4-pixel-wide edge band by inverse
   // distance weighting.
-  for (int x = 0; x < width; x++) {
-    for (int y = 0; y < height; y++) {
-      int p = y * width + x;
-      if (
-        (
-         mask[p] == BLUEPOSITION ||
-         mask[p] == REDPOSITION
-        )
-        and
-        (
-         x + y < origWidth + 3 ||                    // NW edge
-         x >= y + origWidth - 3 ||                   // NE edge
-         x + y >= origWidth + 2 * origHeight - 5 ||  // SE edge
-         y >= x + origWidth - 4                      // SW edge
-        )
-      ) {
-        float avg = 0;
-        float weight = 0;
-        int
-          n = (y - 1) * width + x,
-          s = (y + 1) * width + x,
-          ne = (y - 1) * width + x + 1,
-          se = (y + 1) * width + x + 1,
-          sw = (y + 1) * width + x - 1,
-          nw = (y - 1) * width + x - 1;
-
-        // East and west corners are special cases because
-        // in the east corner the [ne] and [se] pixels are undefined,
-        // and in the west corner the [nw] and [sw] pixels are undefined
-        // and cannot be tested.
-        if (x == 0) { // West corner red
-          ogreen[p] = (ogreen[ne] + ogreen[se]) / 2;
-        }
-        else if (x == width - 1) { // East corner blue
-          ogreen[p] = (ogreen[nw] + ogreen[sw]) / 2;
-        }
-        else {
-          // Each non-green pixel is surrounded by 6 green pixels,
-          // except on the fringes.
-          //
-          // G G G
-          //   *
-          // G G G
-          //
-          if (mask[nw] != BLANK) {
-            avg += ogreen[nw] / DIAG;
-            weight += 1 / DIAG;
-          }
-          if (mask[n] != BLANK) {
-            avg += ogreen[n];
-            weight += 1;
-          }
-          if (mask[ne] != BLANK) {
-            avg += ogreen[ne] / DIAG;
-            weight += 1 / DIAG;
-          }
-
-          if (mask[sw] != BLANK) {
-            avg += ogreen[sw] / DIAG;
-            weight += 1 / DIAG;
-          }
-          if (mask[s] != BLANK) {
-            avg += ogreen[s];
-            weight += 1;
-          }
-          if (mask[se] != BLANK) {
-            avg += ogreen[se] / DIAG;
-            weight += 1 / DIAG;
-          }
-          ogreen[p] = avg / weight;
-        }
-      }
-    }
-  }
+  exr_green_edges(ogreen, width, height, origWidth, origHeight, mask);
 
   // Interpolate the green by Adams-Hamilton algorithm inside the image.
 
 
   // **************************** G R E E N **************************************
   // First interpolate the green channel directionally, using adaptive color plane
-  // interpolation.
-
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      int p = y * width + x;
-      if (
-        mask[p] != GREENPOSITION and
-        x + y >= origWidth - 1 + 4 and                   // NW edge
-        y > x - origWidth - 1 + 4 and                    // NE edge
-        x + y < origWidth + 2 * origHeight - 1 - 4 and   // SE edge
-        x > y - origWidth + 4                            // SW edge
-      ) {
-        int
-          n = (y - 1) * width + x,
-          n2 = (y - 2) * width + x,
-          s = (y + 1) * width + x,
-          s2 = (y + 2) * width + x,
-          ne = (y - 1) * width + x + 1,
-          se = (y + 1) * width + x + 1,
-          sw = (y + 1) * width + x - 1,
-          nw = (y - 1) * width + x - 1,
-          ne2 = (y - 2) * width + x + 2,
-          se2 = (y + 2) * width + x + 2,
-          sw2 = (y + 2) * width + x - 2,
-          nw2 = (y - 2) * width + x - 2;
-
-        // Compute gradients in the green channel.
-        //
-        // N - S
-        float gn = fabsf(ogreen[n] - ogreen[s]); // diagonal distance is longer
-
-        // NW - SE
-        float gnw = fabsf(ogreen[nw] - ogreen[se]) / DIAG; // diagonal distance is longer
-
-        // NE - SW
-        float gne = fabsf(ogreen[ne] - ogreen[sw]) / DIAG;
-
-        float d2nw, d2n, d2ne;
-
-        // Compute diagonal second derivatives in the same channel as current
-        // pixel.
-
-        if (mask[p] == REDPOSITION) {
-          //
-          //     NW          N           N          NE
-          //               even         odd
-          // R . . . .   . R . . .   . . . R .   . . . . R
-          // . . . . .   . . . . .   . . . . .   . . . . .
-          // . . * . .   . . * . .   . . * . .   . . * . .
-          // . . . . .   . . . . .   . . . . .   . . . . .
-          // . . . . R   . R . . .   . . . R .   R . . . .
-          //
-          d2nw = (2.0 * ored[p] - ored[nw2] - ored[se2]) / 8.0; // (2 * DIAG) squared
-          d2ne = (2.0 * ored[p] - ored[ne2] - ored[sw2]) / 8.0;
-          // almost vertical
-          if (x % 2) {
-            d2n  = (2.0 * ored[p] - ored[n2 - 1] - ored[s2 - 1]) / 5.0; // (DIAG12 squared
-          }
-          else {
-            d2n  = (2.0 * ored[p] - ored[n2 - 1] - ored[s2 - 1]) / 5.0; // (DIAG12 squared
-          }
-        }
-        else { // BLUEPOSITION
-          //
-          //     NW          N          NE
-          //
-          // B . . . .   . . R . .   . . . . B
-          // . . . . .   . . . . .   . . . . .
-          // . . * . .   . . * . .   . . * . .
-          // . . . . .   . . . . .   . . . . .
-          // . . . . B   . . R . .   B . . . .
-          //
-          d2nw = (2.0 * oblue[p] - oblue[nw2] - oblue[se2]) / 8.0;
-          d2ne = (2.0 * oblue[p] - oblue[ne2] - oblue[sw2]) / 8.0;
-          if (x % 2) {
-            d2n  = (2.0 * oblue[p] - oblue[n2 - 1] - oblue[s2 - 1]) / 5.0; // (DIAG12 squared
-          }
-          else {
-            d2n  = (2.0 * oblue[p] - oblue[n2 - 1] - oblue[s2 - 1]) / 5.0; // (DIAG12 squared
-          }
-        }
-
-        // Add second differences to gradients
-        gnw += fabsf(d2nw);
-        gn  += fabsf(d2n);
-        gne += fabsf(d2ne);
-
-        d2n = 0;
-        d2nw = 0;
-        d2ne = 0;
-
-        float gmin = fminf(gnw, fminf(gn, gne));
-
-        // If all differences are similar, compute an isotropic average.
-        if (
-          fabsf(gnw - gmin) < threshold and
-          fabsf(gn - gmin) < threshold and
-          fabsf(gne - gmin) < threshold
-        ) {
-          ogreen[p] =
-            (
-             ogreen[nw] / DIAG + ogreen[n] + ogreen[ne] / DIAG +
-             ogreen[se] / DIAG + ogreen[s] + ogreen[sw] / DIAG
-            ) / (2 + 4 / DIAG) +
-            (d2nw + d2n + d2ne) / 3;
-        }
-        else if (gmin == gnw) {
-          // NW average
-          ogreen[p] = (ogreen[nw] + ogreen[se]) / 2.0 + d2nw;
-        }
-        else if (gmin == gn) {
-          // N
-          ogreen[p] = (ogreen[n] + ogreen[s]) / 2.0 + d2n;
-        }
-        else if (gmin == gne) {
-          // NE
-          ogreen[p] = (ogreen[ne] + ogreen[sw]) / 2.0 + d2ne;
-        }
-      } // if not green
-    } // directional green, columns
-  } // directional green, rows
+  // interpolation. All non-green pixels are in odd rows; the interior only
+  // reads green sites and raw red and blue, so rows are independent.
+
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int y = 1; y < height; y += 2) {
+    int xa, xb, ia, ib;
+    exr_row_span(y, width, origWidth, origHeight, &xa, &xb);
+    exr_green_interior(y, xa, xb, origWidth, origHeight, &ia, &ib);
+    if (ia < ib) {
+      green_directional_row(threshold, ored, ogreen, oblue, y, ia, ib, width);
+    }
+  }
 
   end_time = clock();
   elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
@@ -308,6 +254,216 @@ void g_directional (
 
 
 
+// The interpolation of blue at one pixel of the edge band; oblue and mask
+// point to row y
+static inline void blue_pixel(float *oblue, int x, int y, int width, int origWidth, int origHeight, const unsigned char *mask) {
+  int p = x;
+  if (mask[p] == BLUEPOSITION or mask[p] == BLANK) return;
+
+  int
+    e = p + 1,
+    w = p - 1;
+
+  if (x + y == origWidth - 1) {  // NW edge
+    if (mask[p] == GREENPOSITION) {
+      oblue[p] = exr_apply(oblue + p, EXR_NW_GREEN_BLUE, width);
+      oblue[e] = exr_apply(oblue + e, EXR_NW_GREEN_BLUE_E, width);
+    }
+  }
+  else if (y == x - origWidth) {  // NE edge
+    if (mask[p] == GREENPOSITION) {
+      oblue[w] = exr_apply(oblue + w, EXR_NE_GREEN_BLUE_W, width);
+      oblue[p] = oblue[w];
+    }
+    else { // REDPOSITION
+      oblue[p] = exr_apply(oblue + p, EXR_NE_RED_BLUE, width);
+      oblue[w] = exr_apply(oblue + w, EXR_NE_RED_BLUE_W, width);
+    }
+  }
+  else if (y == x + origWidth - 1) {  // SW edge
+    if (mask[p] == GREENPOSITION) {
+      oblue[p] = exr_apply(oblue + p, EXR_SW_GREEN_BLUE, width);
+      oblue[e] = exr_apply(oblue + e, EXR_SW_GREEN_BLUE_E, width);
+    }
+  }
+  else if (x + y == origWidth + 2 * origHeight - 2) {  // SE edge
+    if (mask[p] == GREENPOSITION) {
+      oblue[w] = exr_apply(oblue + w, EXR_SE_GREEN_BLUE_W, width);
+      oblue[p] = oblue[w];
+    }
+    else { // REDPOSITION
+      oblue[p] = exr_apply(oblue + p, EXR_SE_RED_BLUE, width);
+      oblue[w] = oblue[p];
+    }
+  }
+  else if ( // Green interior and east edge bands
+    mask[p] == GREENPOSITION and
+    x + y >= origWidth - 1 + 2 and               // exclude NW edge band
+    x > y - origWidth + 2 and                    // exclude SW edge band
+    y > x - origWidth - 1 + 2 and                // exclude NE edge band
+    x + y < origWidth + 2 * origHeight - 1 - 2   // exclude SE edge band
+  ) {
+    oblue[p] = exr_apply<3>(oblue + p, EXR_GREEN_BLUE[(x + y) & 3], width);
+  }
+  else if ( // Red interior (edge bands have already been excluded above)
+    mask[p] == REDPOSITION
+  ) {
+    oblue[p] = exr_apply<4>(oblue + p, EXR_PAIR[(x + y) & 3], width);
+  }
+}
+
+
+// The interpolation of red at one pixel of the edge band
+static inline void red_pixel(float *ored, int x, int y, int width, int origWidth, const unsigned char *mask, const exr_stencil *green_red) {
+  int p = x;
+  if (mask[p] == REDPOSITION or mask[p] == BLANK) return;
+
+  int e = p + 1;
+
+  if (x + y == origWidth - 1) {  // NW edge
+    if (mask[p] == GREENPOSITION) {
+      ored[e] = exr_apply(ored + e, EXR_NW_GREEN_RED_E, width);
+      ored[p] = ored[e];
+    }
+    else { // BLUEPOSITION
+      ored[e] = exr_apply(ored + e, EXR_NW_BLUE_RED_E, width);
+      ored[p] = exr_apply(ored + p, EXR_NW_BLUE_RED, width);
+    }
+  }
+  else if (x == y - origWidth + 1) { // SW edge
+    if (mask[p] == GREENPOSITION) {
+      ored[e] = exr_apply(ored + e, EXR_SW_GREEN_RED_E, width);
+      ored[p] = ored[e];
+    }
+    else { // BLUEPOSITION
+      ored[p] = exr_apply(ored + p, EXR_SW_BLUE_RED, width);
+      ored[e] = exr_apply(ored + e, EXR_SW_BLUE_RED_E, width);
+    }
+  }
+  else if ( // Green interior and east edges
+    mask[p] == GREENPOSITION and
+    x + y >= origWidth + 1 and  // exclude NW edge (it has been filled)
+    x > y - origWidth + 2       // exclude SW edge (it has been filled)
+  ) {
+    const exr_stencil &s = green_red[(x + y) & 3];
+    ored[p] = s.n == 2 ? exr_apply<2>(ored + p, s, width) : exr_apply<3>(ored + p, s, width);
+  }
+  else if ( // Blue interior (blue does not occur on the west side)
+    mask[p] == BLUEPOSITION and
+    x + y >= origWidth + 2 and  // exclude NW edge
+    x > y - origWidth + 2       // exclude SW edge
+  ) {
+    ored[p] = exr_apply<4>(ored + p, EXR_PAIR[(x + y) & 3], width);
+  }
+}
+
+
+// Apply the stencil of one phase to every fourth pixel of a row, starting
+// at the first xa <= x with (x + y) % 4 == phase
+template <int N>
+static inline void stencil_row(float *row, const exr_stencil &s, int phase, int y, int xa, int xb, int width) {
+  for (int x = xa + ((phase - xa - y) & 3); x < xb; x += 4) {
+    row[x] = exr_apply<N>(row + x, s, width);
+  }
+}
+
+
+// Interior of row y left to the parallel pass of exr_red_blue(). In odd
+// rows, it starts and ends on a boundary of red and blue pairs.
+static inline void rb_interior(int y, int width, int origWidth, int origHeight, int *ia, int *ib) {
+  int xa, xb;
+  exr_row_span(y, width, origWidth, origHeight, &xa, &xb);
+  *ia = xa + RB_EDGE_BAND;
+  *ib = xb - RB_EDGE_BAND;
+  if (y % 2) {
+    *ia += (*ia + y + 1) & 1;
+    *ib -= (*ib + y + 1) & 1;
+  }
+  if (*ia > *ib) *ia = *ib = xa;
+}
+
+
+void exr_red_blue_row(
+  float *red,
+  float *blue,
+  int y,
+  int width,
+  int origWidth,
+  int origHeight,
+  const exr_stencil *green_red
+) {
+  int xa, xb;
+  rb_interior(y, width, origWidth, origHeight, &xa, &xb);
+
+  for (int phase = 0; phase < 4; phase++) {
+    if (y % 2 == 0) {
+      stencil_row<3>(blue, EXR_GREEN_BLUE[phase], phase, y, xa, xb, width);
+      if (green_red[phase].n == 2) stencil_row<2>(red, green_red[phase], phase, y, xa, xb, width);
+      else stencil_row<3>(red, green_red[phase], phase, y, xa, xb, width);
+    }
+    else {
+      // Red pairs are at phases 1 and 2, blue pairs at 3 and 0
+      float *row = (phase == 1 or phase == 2) ? blue : red;
+      stencil_row<4>(row, EXR_PAIR[phase], phase, y, xa, xb, width);
+    }
+  }
+}
+
+
+void exr_red_blue_band_row(
+  float *red,
+  float *blue,
+  const unsigned char *mask,
+  int y,
+  int width,
+  int origWidth,
+  int origHeight,
+  const exr_stencil *green_red
+) {
+  int xa, xb, ia, ib;
+  exr_row_span(y, width, origWidth, origHeight, &xa, &xb);
+  rb_interior(y, width, origWidth, origHeight, &ia, &ib);
+
+  for (int x = xa; x < xb; x++) {
+    if (x == ia) x = MAX(ib, ia);
+    if (x >= xb) break;
+    blue_pixel(blue, x, y, width, origWidth, origHeight, mask);
+  }
+  for (int x = xa; x < xb; x++) {
+    if (x == ia) x = MAX(ib, ia);
+    if (x >= xb) break;
+    red_pixel(red, x, y, width, origWidth, mask, green_red);
+  }
+}
+
+
+void exr_red_blue(
+  float *ored,
+  float *oblue,
+  int width,
+  int height,
+  int origWidth,
+  int origHeight,
+  unsigned char *mask,
+  const exr_stencil *green_red
+) {
+  // The interior stencils only read raw samples of the interpolated channel,
+  // so each row can be done on its own, one phase of the lattice at a time.
+  // The edge rules also read and write interpolated pixels, so their result
+  // depends on the order of the pixels; they are done, with everything
+  // within RB_EDGE_BAND pixels of the edges, in a thin sequential pass, row
+  // by row.
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int y = 0; y < height; y++) {
+    exr_red_blue_row(ored + y * width, oblue + y * width, y, width, origWidth, origHeight, green_red);
+  }
+
+  for (int y = 0; y < height; y++) {
+    exr_red_blue_band_row(ored + y * width, oblue + y * width, mask + y * width, y, width, origWidth, origHeight, green_red);
+  }
+} // exr_red_blue()
+
+
 /**
  * \brief  Classical bilinear interpolation of red and blue differences with the green channel
  *
@@ -330,349 +486,16 @@ void bilinear_red_blue(
   unsigned char *mask
 ) {
   // Compute the differences
+  #pragma omp parallel for
   for (int i = 0; i < width * height; i++) {
     ored[i] -= ogreen[i];
     oblue[i] -= ogreen[i];
   }
 
-  // Interpolate blue differences making the average of possible values depending on the CFA location
-  for (int x = 0; x < width; x++) {
-    for (int y = 0; y < height; y++) {
-      int p = y * width + x;
-      if (mask[p] != BLUEPOSITION and mask[p] != BLANK) {
-        int
-          n = (y - 1) * width + x,
-          s = (y + 1) * width + x,
-          e = p + 1,
-          w = p - 1,
-          e2 = p + 2,
-          w2 = p - 2,
-          ne = (y - 1) * width + x + 1,
-          se = (y + 1) * width + x + 1,
-          sw = (y + 1) * width + x - 1,
-          nw = (y - 1) * width + x - 1,
-          n2 = (y - 2) * width + x,
-          s2 = (y + 2) * width + x;
-
-        if (x + y == origWidth - 1) {  // NW edge
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average the closest blue pixels.
-            //
-            //     B B . .
-            //   * e . . .
-            // B B . . B b
-            // . . . . . .
-            // . . b b . .
-            //
-            oblue[p] = (oblue[sw]/DIAG   + oblue[s]      + oblue[ne]/DIAG + oblue[ne + 1]/DIAG12) / (1/DIAG + 1 + 1/DIAG + 1/DIAG12);
-            oblue[e] = (oblue[sw]/DIAG12 + oblue[s]/DIAG + oblue[ne]      + oblue[ne + 1]/DIAG + oblue[se + 2]/DIAG12) / (1/DIAG12 + 1/DIAG + 1 + 1/DIAG + 1/DIAG12);
-          }
-        }
-        else if (y == x - origWidth) {  // NE edge
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average the underlying red block to the inner green pixel
-            // (w) and copy it to the outer green pixel (*). All other blue
-            // pixels are too far to be useful.
-            //
-            // b b . .
-            // . . . w *
-            // . . B B . .
-            // . . . . . .
-            // b b . . b b
-            //
-            oblue[w] = (oblue[sw - 1]/DIAG + oblue[sw]) / (1 + 1/DIAG);
-            oblue[p] = oblue[w];
-          }
-          else { // REDPOSITION
-            // Each red block can be interpolated from the closest two blue blocks.
-            //
-            //  Inner       Outer
-            //
-            // . . .       . . .
-            // . B w *     . B - *
-            // . . | \ .   . . / | .
-            // . . B B .   . . B B .
-            // . . . . .   . . . . .
-            //
-            oblue[p] = (oblue[s2]/2 + oblue[s2 - 1]/DIAG12 + oblue[w2]/2) / (1 + 1 / DIAG12);
-            oblue[w] = (oblue[s2 - 1]/2 + oblue[s2]/DIAG12 + oblue[w2]) / (1.5 + 1 / DIAG12);
-          }
-        }
-        else if (y == x + origWidth - 1) {  // SW edge
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average the closest blue pixels.
-            //
-            // . . B B . .
-            // . . . . . .
-            // B B . . B B
-            //   * e . . .
-            //     B B . .
-            //
-            oblue[p] = (oblue[nw]/DIAG   + oblue[n]      + oblue[se]/DIAG + oblue[se + 1]/DIAG12) / (1/DIAG + 1 + 1/DIAG + 1/DIAG12);
-            oblue[e] = (oblue[nw]/DIAG12 + oblue[n]/DIAG + oblue[se]      + oblue[se + 1]/DIAG + oblue[ne + 2]/DIAG12) / (1/DIAG12 + 1/DIAG + 1 + 1/DIAG + 1/DIAG12);
-          }
-          // else { // REDPOSITION
-          //   // Each red block can be interpolated from the closest two blue blocks.
-          //   //
-          //   //   Outer        Inner
-          //   //
-          //   // . . . . .    . . . . .
-          //   // . B B . .    . B B . .
-          //   // . | / . .    . \ | . .
-          //   //   * - B .      * R B .
-          //   //     . . .        . . .
-          //   //
-          //   oblue[p] = (oblue[n2] / 2 + oblue[n2 + 1] / DIAG12 + oblue[e2] / 2) / (1 + 1 / DIAG12);
-          //   oblue[e] = (oblue[n2 - 1] / DIAG12 + oblue[n2] / 2 + oblue[e]) / (1.5 + 1 / DIAG12);
-          // }
-        }
-        else if (x + y == origWidth + 2 * origHeight - 2) {  // SE edge
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average the overlying blue block to the inner green pixel
-            // (w) and copy it to the outer green pixel (*). All other blue
-            // pixels are too far to be useful.
-            //
-            // b b . . b b
-            // . . . . . .
-            // . . B B . .
-            // . . . w *
-            // b b . .
-            //
-            oblue[w] = (oblue[nw] + oblue[nw - 1] / DIAG) / (1 + 1 / DIAG);
-            oblue[p] = oblue[w];
-          }
-          else { // REDPOSITION
-            // Each red block can be interpolated from the closest two blue blocks.
-            //
-            //   Outer        Inner
-            //
-            // . . . . .    . . . . .
-            // . . B B .    . . B B .
-            // . . \ | .    . . | / .
-            // . B - *      . B w *
-            // . . .        . . .
-            //
-            oblue[p] = (oblue[n2] / 2 + oblue[n2 - 1] / DIAG12 + oblue[w2] / 2) / (1 + 1 / DIAG12);
-            oblue[w] = oblue[p];
-          }
-        }
-        else if ( // Green interior and east edge bands
-          mask[p] == GREENPOSITION and
-          x + y >= origWidth - 1 + 2 and               // exclude NW edge band
-          x > y - origWidth + 2 and                    // exclude SW edge band
-          y > x - origWidth - 1 + 2 and                // exclude NE edge band
-          x + y < origWidth + 2 * origHeight - 1 - 2   // exclude SE edge band
-        ) {
-          // The interpolation pattern for green pixels depends on their horizontal position.
-          if ((x + y + 3) % 4 == 0) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // B B . . . . .
-            // . * . . . . .
-            // . . B . . . .
-            // . . . . . . .
-            //
-            oblue[p] = (oblue[nw] / DIAG + oblue[se] / DIAG + oblue[n]) / (1 + 2 / DIAG);
-          }
-          if ((x + y + 3) % 4 == 1) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . B . . . . .
-            // . . * . . . .
-            // . . B B . . .
-            // . . . . . . .
-            //
-            oblue[p] = (oblue[nw] / DIAG + oblue[se] / DIAG + oblue[s]) / (1 + 2 / DIAG);
-          }
-          if ((x + y + 3) % 4 == 2) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . . . . B . .
-            // . . . * . . .
-            // . . B B . . .
-            // . . . . . . .
-            //
-            oblue[p] = (oblue[ne] / DIAG + oblue[sw] / DIAG + oblue[s]) / (1 + 2 / DIAG);
-          }
-          if ((x + y + 3) % 4 == 3) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . . . . B B .
-            // . . . . * . .
-            // . . . B . . .
-            // . . . . . . .
-            //
-            oblue[p] = (oblue[ne] / DIAG + oblue[sw] / DIAG + oblue[n]) / (1 + 2 / DIAG);
-          }
-        }
-
-        else if ( // Red interior (edge bands have already been excluded above)
-          mask[p] == REDPOSITION
-        ) {
-          if (x % 2 == 0) {
-            oblue[p] = (oblue[n2] / 2 + oblue[e2] / 2 + oblue[s2] / 2 + oblue[w]) / 2.5;
-          }
-          else {
-            oblue[p] = (oblue[n2] / 2 + oblue[e] + oblue[s2] / 2 + oblue[w2] / 2) / 2.5;
-          }
-        }
-      }
-    }
-  }
-
-  // Interpolate red differences making the average of possible values depending on the CFA location
-  for (int x = 0; x < width; x++) {
-    for (int y = 0; y < height; y++) {
-      int p = y * width + x;
-      if (mask[p] != REDPOSITION and mask[p] != BLANK) {
-        int
-          n = (y - 1) * width + x,
-          s = (y + 1) * width + x,
-          e = p + 1,
-          w = p - 1,
-          e2 = p + 2,
-          w2 = p - 2,
-          ne = (y - 1) * width + x + 1,
-          se = (y + 1) * width + x + 1,
-          sw = (y + 1) * width + x - 1,
-          nw = (y - 1) * width + x - 1,
-          n2 = (y - 2) * width + x,
-          s2 = (y + 2) * width + x;
-
-
-        if (x + y == origWidth - 1) {  // NW edge
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average the underlying red block to the inner green pixel
-            // (G) and copy it to the outer green pixel (*). All other red
-            // pixels are too far to be useful.
-            //
-            //     . . r r
-            //   * e . . .
-            // . . R R . .
-            // . . . . . .
-            // r r . . r r
-            //
-            ored[e] = (ored[se] + ored[se + 1] / DIAG) / (1 + 1 / DIAG);
-            ored[p] = ored[e];
-          }
-          else { // BLUEPOSITION
-            // Each blue block can be interpolated from the closest two red blocks.
-            //
-            //  Inner       Outer
-            //
-            //     . . .       . . .
-            //   * e R .     * - R .
-            // . / | . .   . | \ . .
-            // . R R . .   . R R . .
-            // . . . . .   . . . . .
-            //
-            ored[e] = (ored[s2] / DIAG12 + ored[s2 + 1] / 2 + ored[e2]) / (1.5 + 1 / DIAG12);
-            ored[p] = (ored[s2] / 2 + ored[s2 + 1] / DIAG12 + ored[e2] / 2) / (1 + 1 / DIAG12);
-          }
-        }
-        else if (x == y - origWidth + 1) { // SW edge
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average the overlying red block to the inner green pixel
-            // (e) and copy it to the outer green pixel (*). All other red
-            // pixels are too far to be useful.
-            //
-            // r r . . r r
-            // . . . . . .
-            // . . R R . .
-            //   * e . . .
-            //     . . r r
-            //
-            ored[e] = (ored[ne] + ored[ne + 1] / DIAG) / (1 + 1 / DIAG);
-            ored[p] = ored[e];
-          }
-          else { // BLUEPOSITION
-            // Each blue block can be interpolated from the closest two red blocks.
-            //
-            //   Outer        Inner
-            //
-            // . . . . .    . . . . .
-            // . R R . .    . R R . .
-            // . | / . .    . \ | . .
-            //   * - R .      * e R .
-            //     . . .        . . .
-            //
-            ored[p] = (ored[n2] / 2 + ored[n2 + 1] / DIAG12 + ored[e2] / 2) / (1 + 1 / DIAG12);
-            ored[e] = (ored[n2] / DIAG12 + ored[n2 + 1] / 2 + ored[e2]) / (1.5 + 1 / DIAG12);
-          }
-        }
-        else if ( // Green interior and east edges
-          mask[p] == GREENPOSITION and
-          x + y >= origWidth + 1 and  // exclude NW edge (it has been filled)
-          x > y - origWidth + 2       // exclude SW edge (it has been filled)
-        ) {
-          // The interpolation pattern for green pixels depends on their horizontal position.
-          if ((x + y + 1) % 4 == 0) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // R R . . . . .
-            // . * . . . . .
-            // . . R . . . .
-            // . . . . . . .
-            //
-            ored[p] = (ored[nw] / DIAG + ored[se] / DIAG + ored[n]) / (1 + 2 / DIAG);
-          }
-          if ((x + y + 1) % 4 == 1) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . R . . . . .
-            // . . * . . . .
-            // . . R R . . .
-            // . . . . . . .
-            //
-            ored[p] = (ored[nw] / DIAG + ored[se] / DIAG + ored[s]) / (1 + 2 / DIAG);
-          }
-          if ((x + y + 1) % 4 == 2) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . . . . R . .
-            // . . . * . . .
-            // . . R R . . .
-            // . . . . . . .
-            //
-            ored[p] = (ored[ne] / DIAG + ored[sw] / DIAG + ored[s]) / (1 + 2 / DIAG);
-          }
-          if ((x + y + 1) % 4 == 3) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . . . . R R .
-            // . . . . * . .
-            // . . . R . . .
-            // . . . . . . .
-            //
-            ored[p] = (ored[ne] / DIAG + ored[sw] / DIAG + ored[n]) / (1 + 2 / DIAG);
-          }
-        }
-
-        else if ( // Blue interior (blue does not occur on the west side)
-          mask[p] == BLUEPOSITION and
-          x + y >= origWidth + 2 and  // exclude NW edge
-          x > y - origWidth + 2       // exclude SW edge
-        ) {
-          if (x % 2 == 0) {
-            ored[p] = (ored[n2] / 2 + ored[e2] / 2 + ored[s2] / 2 + ored[w]) / 2.5;
-          }
-          else {
-            ored[p] = (ored[n2] / 2 + ored[e] + ored[s2] / 2 + ored[w2] / 2) / 2.5;
-          }
-        }
-      }
-    }
-  }
+  exr_red_blue(ored, oblue, width, height, origWidth, origHeight, mask, EXR_GREEN_RED);
 
   // Make back the differences
+  #pragma omp parallel for
   for (int i = 0; i < width * height; i++){
     ored[i] += ogreen[i];
     // ored[i] *= 1.565476;
@@ -706,10 +529,31 @@ void bilinear_red_blue(
 
  * @param[in]  h kernel bandwidth
  * @param[in]  width, height size of the image
+ * @param[in]  green_only  if true, only green is interpolated, from green
+ *                 candidates; red and blue keep their input values
+ * @param[in,out]  graph  if not NULL and not yet filled, the k best candidates
+ *                 of each channel are recorded in it; if filled, only those
+ *                 candidates are re-weighted
  *
  */
 
 
+// Sum of 3x3 patch distances over the three channels
+static inline float nlm_distance(
+  float *ired,
+  float *igreen,
+  float *iblue,
+  int x, int y,
+  int i, int j,
+  int width
+) {
+  return
+    l2_distance_r1(ired,   x, y, i, j, width) +
+    l2_distance_r1(igreen, x, y, i, j, width) +
+    l2_distance_r1(iblue,  x, y, i, j, width);
+}
+
+
 void demosaic_nlmeans(
   int radius,
   float h,
@@ -723,12 +567,34 @@ void demosaic_nlmeans(
   int height,
   int origWidth,
   int origHeight,
-  unsigned char *mask
+  unsigned char *mask,
+  bool green_only,
+  nlm_graph *graph
 ) {
   clock_t start_time, end_time;
   double elapsed;
 
-  fprintf(stderr, "running NLM interpolation with a %dx%d search block and h = %6.3f ...\n", 2 *radius + 1, 2 * radius + 1, h);
+  bool record = graph and not graph->filled;
+  bool reuse = graph and graph->filled;
+
+  if (reuse) {
+    fprintf(stderr, "running NLM interpolation on %d cached candidates per channel and h = %6.3f ...\n", graph->k, h);
+  }
+  else {
+    fprintf(stderr, "running NLM interpolation with a %dx%d search block and h = %6.3f ...\n", 2 *radius + 1, 2 * radius + 1, h);
+  }
+  if (green_only) {
+    fprintf(stderr, "  interpolating green only\n");
+  }
+
+  if (graph and graph->radius != radius) {
+    fprintf(stderr, "demosaic_nlmeans(): neighbour graph was built for radius %d, not %d\n", graph->radius, radius);
+    exit(EXIT_FAILURE);
+  }
+  if (graph and graph->channels != (green_only ? 1 : 2)) {
+    fprintf(stderr, "demosaic_nlmeans(): neighbour graph was built for %d interpolated channels\n", graph->channels);
+    exit(EXIT_FAILURE);
+  }
 
   start_time = clock();
   wxCopy(ired, ored, width * height);
@@ -742,28 +608,37 @@ void demosaic_nlmeans(
   elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
   fprintf(stderr, "%6.3f seconds to initialize outputs and tabulate Exp(-x)\n", elapsed);
 
+  // Candidate lists of the interpolated channels, used while recording
+  // the neighbour graph. Offsets are coded as in nlm_graph.
+  int side = 2 * radius + 1;
+  int slots = graph ? graph->channels * graph->k : 0;
+  std::pair<float, unsigned char> *candidates[2] = {NULL, NULL};
+  if (record) {
+    candidates[0] = new std::pair<float, unsigned char>[side * side];
+    candidates[1] = new std::pair<float, unsigned char>[side * side];
+    memset(graph->codes, NLM_GRAPH_EMPTY, (size_t)width * height * slots);
+  }
+
   start_time = clock();
   progressbar *pbar = progressbar_new("  ", height - 2);
-  // for each pixel in the interior
+  // for each pixel in the interior, which keeps radius + 3 pixels away from
+  // the diamond edges:
+  //
+  //   x + y >= origWidth + 3 + radius - 1                  (NW edge)
+  //   x < y + origWidth - 3 - radius + 1                   (NE edge)
+  //   x + y < origWidth + 2 * origHeight - 5 - radius + 1  (SE edge)
+  //   y < x + origWidth - 4 - radius + 1                   (SW edge)
+  //
   for (int y = 2; y < height - 2; y++) {
-    for (int x = 2; x < width - 2; x++) {
+    int xa = MAX(2, MAX(origWidth + 2 + radius - y, y - origWidth + 4 + radius));
+    int xb = MIN(width - 2, MIN(y + origWidth - 2 - radius, origWidth + 2 * origHeight - 4 - radius - y));
+
+    for (int x = xa; x < xb; x++) {
       int p = y * width + x;
       if (
         mask[p] != BLANK and
-        (
-         x + y >= origWidth + 3 + radius - 1 and                  // NW edge
-         x < y + origWidth - 3 - radius + 1 and                   // NE edge
-         x + y < origWidth + 2 * origHeight - 5 - radius + 1 and  // SE edge
-         y < x + origWidth - 4 - radius + 1                       // SW edge
-        )
+        not (green_only and mask[p] == GREENPOSITION)
       ) {
-        // Learning zone depending on window size
-        int imin = MAX(x - radius, 1);
-        int jmin = MAX(y - radius, 1);
-
-        int imax = MIN(x + radius, width - 2);
-        int jmax = MIN(y + radius, height - 2);
-
         // auxiliary variables for computing average
         float red = 0.0;
         float green = 0.0;
@@ -773,50 +648,76 @@ void demosaic_nlmeans(
         float gweight = 0.0;
         float bweight = 0.0;
 
+        int ncandidates[2] = {0, 0};
+
+        // Either the whole learning zone or the candidates cached by the
+        // first pass.
+        int count = reuse ? slots : side * side;
+        unsigned char *code = reuse ? graph->codes + (size_t)p * slots : NULL;
 
         // for each pixel in the neighborhood
-        for (int j = jmin; j <= jmax; j++) {
-          for (int i = imin; i <= imax; i++) {
-
-            // index of neighborhood pixel
-            int n = j * width + i;
-
-            // We only interpolate channels other than the current pixel channel
-            if (mask[p] != mask[n]) {
-
-              // Distances computed on color
-              float sum = 0.0;
-
-              sum = l2_distance_r1(ired,  x, y, i, j, width);
-              sum += l2_distance_r1(igreen,  x, y, i, j, width);
-              sum += l2_distance_r1(iblue,  x, y, i, j, width);
-
-              // Compute weight
-              sum /= (65536 * 27.0 * h); // The original was probably tuned to 8-bit images (so the sum is 256^2 larger)
-              // sum /= (8192 * 27.0 * h); // this seems to produce a more agreeable denoising on red
-
-              // weight = exp(-sum)
-              float weight = sLUT(sum, lut);
-
-              // Add pixel to corresponding channel average
-              if (mask[n] == GREENPOSITION)  {
-                green += weight * igreen[n];
-                gweight += weight;
-              }
-              else if (mask[n] == REDPOSITION) {
-                red += weight * ired[n];
-                rweight += weight;
-              }
-              else {
-                blue += weight * iblue[n];
-                bweight += weight;
-              }
+        for (int c = 0; c < count; c++) {
+          int offset = reuse ? code[c] : c;
+          if (reuse and offset == NLM_GRAPH_EMPTY) continue;
+
+          int i = x + offset % side - radius;
+          int j = y + offset / side - radius;
+
+          // The margin of the interior keeps the whole learning zone, and
+          // the stencil of nlm_distance() around it, inside the canvas.
+
+          // index of neighborhood pixel
+          int n = j * width + i;
 
+          // We only interpolate channels other than the current pixel channel
+          // (only green in the green-only mode)
+          if (mask[p] != mask[n] and not (green_only and mask[n] != GREENPOSITION)) {
+
+            // Distances computed on color
+            float sum = nlm_distance(ired, igreen, iblue, x, y, i, j, width);
+
+            if (record and mask[n] != BLANK) {
+              // slot 0 is the lower of the two interpolated channels, or
+              // green alone
+              int slot = green_only ? 0 : mask[n] < mask[p] ? mask[n] - 1 : mask[n] - 2;
+              candidates[slot][ncandidates[slot]++] = std::make_pair(sum, (unsigned char)offset);
             }
 
+            // Compute weight
+            sum /= (65536 * 27.0 * h); // The original was probably tuned to 8-bit images (so the sum is 256^2 larger)
+            // sum /= (8192 * 27.0 * h); // this seems to produce a more agreeable denoising on red
+
+            // weight = exp(-sum)
+            float weight = sLUT(sum, lut);
+
+            // Add pixel to corresponding channel average
+            if (mask[n] == GREENPOSITION)  {
+              green += weight * igreen[n];
+              gweight += weight;
+            }
+            else if (mask[n] == REDPOSITION) {
+              red += weight * ired[n];
+              rweight += weight;
+            }
+            else {
+              blue += weight * iblue[n];
+              bweight += weight;
+            }
           }
         }
 
+        // Keep the k most similar candidates of each interpolated channel
+        if (record) {
+          unsigned char *code = graph->codes + (size_t)p * slots;
+          for (int slot = 0; slot < graph->channels; slot++) {
+            int kept = std::min(ncandidates[slot], graph->k);
+            std::nth_element(candidates[slot], candidates[slot] + kept, candidates[slot] + ncandidates[slot]);
+            for (int c = 0; c < kept; c++) {
+              *code++ = candidates[slot][c].second;
+            }
+            code += graph->k - kept;
+          }
+        }
 
         // Set value to current pixel
         if (mask[p] != GREENPOSITION and gweight > fTiny) ogreen[p] = green / gweight;
@@ -835,6 +736,11 @@ void demosaic_nlmeans(
   progressbar_finish(pbar);
 
   delete[] lut;
+  if (record) {
+    delete[] candidates[0];
+    delete[] candidates[1];
+    graph->filled = true;
+  }
 
   end_time = clock();
   elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
@@ -842,9 +748,498 @@ void demosaic_nlmeans(
 }
 
 
+/**
+ * \brief  Transform the filtered chromatic components of a pixel back to RGB
+ *
+ * Y is recomputed from the unfiltered input at p.
+ *
+ */
+
+static inline void chroma_to_rgb(
+  int projflag,
+  int p,
+  float u,
+  float v,
+  const float *ired,
+  const float *igreen,
+  const float *iblue,
+  const unsigned char *mask,
+  float *ored,
+  float *ogreen,
+  float *oblue
+) {
+  float Y = (COEFF_YR * ired[p] + COEFF_YG * igreen[p] + COEFF_YB * iblue[p]);
+  float r = (u + Y);
+  float g = (Y - COEFF_YR * (u + Y) - COEFF_YB * (v +  Y) ) / COEFF_YG;
+  float b = (v + Y);
+
+  // If projection flag is set, put back original CFA values
+  if (projflag) {
+    if (mask[p] == REDPOSITION) r = ired[p];
+    else if (mask[p] == GREENPOSITION) g = igreen[p];
+    else if (mask[p] == BLUEPOSITION) b = iblue[p];
+  }
+
+  *ored = r;
+  *ogreen = g;
+  *oblue = b;
+}
+
+
+/**
+ * \brief  Transform filtered chromatic components of a row back to RGB
+ *
+ * Y is recomputed from the unfiltered input; U0 and V0 are indexed by x.
+ *
+ */
+
+static inline void chroma_to_rgb_row(
+  int projflag,
+  int y,
+  int xa,
+  int xb,
+  const float *U0,
+  const float *V0,
+  const float *ired,
+  const float *igreen,
+  const float *iblue,
+  float *ored,
+  float *ogreen,
+  float *oblue,
+  int width,
+  const unsigned char *mask
+) {
+  for (int x = 0; x < xa; x++) {
+    ored[y * width + x] = ogreen[y * width + x] = oblue[y * width + x] = 0;
+  }
+  for (int x = xb; x < width; x++) {
+    ored[y * width + x] = ogreen[y * width + x] = oblue[y * width + x] = 0;
+  }
+
+  for (int x = xa; x < xb; x++) {
+    int p = y * width + x;
+    chroma_to_rgb(projflag, p, U0[x], V0[x], ired, igreen, iblue, mask, ored + p, ogreen + p, oblue + p);
+  }
+}
+
+
+/**
+ * \brief  Chromatic components of the columns ca .. cb - 1 of a canvas row
+ *
+ * u and v are indexed by x, and are zero outside the diamond.
+ *
+ */
+
+static inline void chroma_uv_row(
+  int y,
+  int ca,
+  int cb,
+  const float *ired,
+  const float *igreen,
+  const float *iblue,
+  float *u,
+  float *v,
+  int width,
+  int origWidth,
+  int origHeight
+) {
+  int xa, xb;
+  exr_row_span(y, width, origWidth, origHeight, &xa, &xb);
+  xa = MIN(MAX(xa, ca), cb);
+  xb = MIN(MAX(xb, xa), cb);
+
+  for (int x = ca; x < xa; x++) u[x] = v[x] = 0;
+  for (int x = xb; x < cb; x++) u[x] = v[x] = 0;
+  for (int x = xa; x < xb; x++) {
+    int p = y * width + x;
+    float Y = (COEFF_YR * ired[p] + COEFF_YG * igreen[p] + COEFF_YB * iblue[p]);
+    u[x] = (ired[p] - Y);
+    v[x] = (iblue[p] - Y);
+  }
+}
+
+
+/**
+ * \brief  One iteration of the chromatic median with a histogram median
+ *
+ * U and V are filtered on the square window of half-size radius. Their
+ * range is found first; then each strip of HIST_STRIP columns converts
+ * the rows its window reaches as it slides down, and converts its pixels
+ * back to RGB as soon as their medians are known, so that no full-canvas
+ * U or V is held.
+ *
+ */
+
+static void chromatic_median_histogram(
+  int projflag,
+  int radius,
+  float *ired,
+  float *igreen,
+  float *iblue,
+  float *ored,
+  float *ogreen,
+  float *oblue,
+  int width,
+  int height,
+  int origWidth,
+  int origHeight,
+  unsigned char *mask
+) {
+  // Range of U and V, blank corners included
+  float ulo = 0, uhi = 0, vlo = 0, vhi = 0;
+  #pragma omp parallel reduction(min:ulo, vlo) reduction(max:uhi, vhi)
+  {
+    float *u = new float[width];
+    float *v = new float[width];
+
+    #pragma omp for schedule(dynamic, CHROMA_BAND)
+    for (int y = 0; y < height; y++) {
+      chroma_uv_row(y, 0, width, ired, igreen, iblue, u, v, width, origWidth, origHeight);
+      for (int x = 0; x < width; x++) {
+        ulo = fminf(ulo, u[x]);
+        uhi = fmaxf(uhi, u[x]);
+        vlo = fminf(vlo, v[x]);
+        vhi = fmaxf(vhi, v[x]);
+      }
+    }
+
+    delete[] u;
+    delete[] v;
+  }
+
+  #pragma omp parallel
+  {
+    // A row of U and V and of their medians, indexed by x
+    float *u = new float[width];
+    float *v = new float[width];
+    float *U0 = new float[width];
+    float *V0 = new float[width];
+
+    #pragma omp for schedule(dynamic)
+    for (int xs = 0; xs < width; xs += HIST_STRIP) {
+      int xe = MIN(xs + HIST_STRIP, width);
+      median_histogram mu, mv;
+      median_histogram_init(&mu, radius, width, height, ulo, uhi, xs, xe);
+      median_histogram_init(&mv, radius, width, height, vlo, vhi, xs, xe);
+
+      for (int y = -radius; y < height; y++) {
+        // Slide the column histograms down to rows y - radius .. y + radius
+        if (y + radius < height) {
+          chroma_uv_row(y + radius, mu.ca, mu.cb, ired, igreen, iblue, u, v, width, origWidth, origHeight);
+          median_histogram_add(&mu, u, 1);
+          median_histogram_add(&mv, v, 1);
+        }
+        if (y - radius - 1 >= 0) {
+          chroma_uv_row(y - radius - 1, mu.ca, mu.cb, ired, igreen, iblue, u, v, width, origWidth, origHeight);
+          median_histogram_add(&mu, u, -1);
+          median_histogram_add(&mv, v, -1);
+        }
+        if (y < 0) continue;
+
+        int xa, xb;
+        exr_row_span(y, width, origWidth, origHeight, &xa, &xb);
+        xa = MIN(MAX(xa, xs), xe);
+        xb = MIN(MAX(xb, xa), xe);
+        long o = (long)y * width;
+
+        for (int x = xs; x < xa; x++) ored[o + x] = ogreen[o + x] = oblue[o + x] = 0;
+        for (int x = xb; x < xe; x++) ored[o + x] = ogreen[o + x] = oblue[o + x] = 0;
+
+        // Perform a Median on YUV component.
+        median_histogram_row(&mu, y, xa, xb, U0);
+        median_histogram_row(&mv, y, xa, xb, V0);
+
+        // Transform back to RGB
+        for (int x = xa; x < xb; x++) {
+          chroma_to_rgb(projflag, o + x, U0[x], V0[x], ired, igreen, iblue, mask, ored + o + x, ogreen + o + x, oblue + o + x);
+        }
+      }
+
+      median_histogram_free(&mu);
+      median_histogram_free(&mv);
+    }
+
+    delete[] u;
+    delete[] v;
+    delete[] U0;
+    delete[] V0;
+  }
+}
+
+
+/**
+ * \brief  Joint bilateral blend of the chroma of four half-resolution cells
+ *
+ * The cells are X0 and X1 on the cell rows q0 and q1, with the bilinear
+ * weights wy, 1 - wy and wx, 1 - wx. Each is also weighted by a Gaussian of
+ * sigma CHROMA_GUIDE_SIGMA of the difference between the luminance of the
+ * pixel and that of the cell, approximated by (1 - d² / 16 sigma²)^8, which
+ * vanishes from 4 sigma. The nearest cell is given the extra weight
+ * CHROMA_GUIDE_FLOOR, so that its chroma is taken if all four vanish.
+ *
+ */
+
+static inline void guided_blend(
+  float r,
+  float g,
+  float b,
+  const float *Y2,
+  const float *U2,
+  const float *V2,
+  long q0,
+  long q1,
+  float wy,
+  int X0,
+  int X1,
+  float wx,
+  float *u,
+  float *v
+) {
+  const float k = 1.0f / (16 * CHROMA_GUIDE_SIGMA * CHROMA_GUIDE_SIGMA);
+  float lum = (COEFF_YR * r + COEFF_YG * g + COEFF_YB * b);
+  long cell[4] = {q0 + X0, q0 + X1, q1 + X0, q1 + X1};
+  float bilinear[4] = {wy * wx, wy * (1 - wx), (1 - wy) * wx, (1 - wy) * (1 - wx)};
+  float su = 0, sv = 0, sw = 0;
+
+  for (int i = 0; i < 4; i++) {
+    float d = lum - Y2[cell[i]];
+    float t = fmaxf(1.0f - k * d * d, 0.0f);
+    t *= t;
+    t *= t;
+    float w = bilinear[i] * t * t;
+    su += w * U2[cell[i]];
+    sv += w * V2[cell[i]];
+    sw += w;
+  }
+
+  long nearest = (wy > 0.5f ? q0 : q1) + (wx > 0.5f ? X0 : X1);
+  su += CHROMA_GUIDE_FLOOR * U2[nearest];
+  sv += CHROMA_GUIDE_FLOOR * V2[nearest];
+  sw += CHROMA_GUIDE_FLOOR;
+  *u = su / sw;
+  *v = sv / sw;
+}
+
+
+/**
+ * \brief  One iteration of the chromatic median at half resolution
+ *
+ * U, V and Y are averaged over 2x2 cells of the canvas (pixels outside the
+ * diamond are left out), U and V are filtered on the half-resolution planes
+ * with the footprint fp, or with wxMedianHistogram() from a radius of
+ * CHROMA_HISTOGRAM_RADIUS, and brought back to full resolution by a joint
+ * bilateral upsampling: each pixel blends its four nearest cells with the
+ * bilinear weights times a Gaussian of the difference between its own Y and
+ * the Y of the cell, so that chroma does not bleed across luminance edges.
+ *
+ * The footprint is in half-resolution pixels, so it spans twice the radius
+ * on the canvas. Cells outside the diamond get a luminance far out of the
+ * range of the guide, so that their weight vanishes without a test (see
+ * guided_blend()). Off the canvas, the nearer cell is used twice, which
+ * gives the same blend as leaving it out.
+ *
+ */
+
+static void chromatic_median_half(
+  int projflag,
+  const median_footprint *fp,
+  float side,
+  float *ired,
+  float *igreen,
+  float *iblue,
+  float *ored,
+  float *ogreen,
+  float *oblue,
+  int width,
+  int height,
+  int origWidth,
+  int origHeight,
+  unsigned char *mask
+) {
+  int hWidth = (width + 1) / 2;
+  int hHeight = (height + 1) / 2;
+  long hSize = (long)hWidth * hHeight;
+  float *U = new float[hSize];
+  float *V = new float[hSize];
+  float *Y2 = new float[hSize];
+  float *U2 = new float[hSize];
+  float *V2 = new float[hSize];
+  int *hxa = new int[hHeight];
+  int *hxb = new int[hHeight];
+
+  // Guide of the cells outside the diamond, far below any luminance
+  float empty = -16 * CHROMA_GUIDE_SIGMA;
+
+  // Downsample to YUV
+  #pragma omp parallel for schedule(dynamic, CHROMA_BAND)
+  for (int Y = 0; Y < hHeight; Y++) {
+    int xa[2], xb[2];
+    for (int j = 0; j < 2; j++) {
+      if (2 * Y + j < height) exr_row_span(2 * Y + j, width, origWidth, origHeight, xa + j, xb + j);
+      else xa[j] = xb[j] = 0;
+    }
+
+    // The two row spans overlap, so every cell in between holds a pixel; an
+    // empty span is moved onto the other one
+    if (xa[0] == xb[0] and xa[1] == xb[1]) xa[0] = xb[0] = xa[1] = xb[1] = 0;
+    else if (xa[0] == xb[0]) xa[0] = xb[0] = xa[1];
+    else if (xa[1] == xb[1]) xa[1] = xb[1] = xa[0];
+    hxa[Y] = MIN(xa[0], xa[1]) / 2;
+    hxb[Y] = (MAX(xb[0], xb[1]) + 1) / 2;
+
+    float *u = U + (long)Y * hWidth;
+    float *v = V + (long)Y * hWidth;
+    float *g = Y2 + (long)Y * hWidth;
+    for (int X = 0; X < hxa[Y]; X++) {
+      u[X] = v[X] = 0;
+      g[X] = empty;
+    }
+    for (int X = hxb[Y]; X < hWidth; X++) {
+      u[X] = v[X] = 0;
+      g[X] = empty;
+    }
+
+    // Cells whose four pixels are inside the diamond
+    int ca = (MAX(xa[0], xa[1]) + 1) / 2;
+    int cb = MAX(MIN(xb[0], xb[1]) / 2, ca);
+    for (int X = ca; X < cb; X++) {
+      long p = (long)2 * Y * width + 2 * X;
+      float r = 0.25f * (ired[p] + ired[p + 1] + ired[p + width] + ired[p + width + 1]);
+      float gr = 0.25f * (igreen[p] + igreen[p + 1] + igreen[p + width] + igreen[p + width + 1]);
+      float b = 0.25f * (iblue[p] + iblue[p + 1] + iblue[p + width] + iblue[p + width + 1]);
+      float lum = (COEFF_YR * r + COEFF_YG * gr + COEFF_YB * b);
+      u[X] = r - lum;
+      v[X] = b - lum;
+      g[X] = lum;
+    }
+
+    // Cells across the edges of the diamond
+    int edge[2][2] = {{hxa[Y], ca}, {cb, hxb[Y]}};
+    for (int e = 0; e < 2; e++) {
+      for (int X = edge[e][0]; X < edge[e][1]; X++) {
+        float r = 0, gr = 0, b = 0;
+        int n = 0;
+        for (int j = 0; j < 2; j++) {
+          for (int x = MAX(2 * X, xa[j]); x < MIN(2 * X + 2, xb[j]); x++) {
+            long p = (long)(2 * Y + j) * width + x;
+            r += ired[p];
+            gr += igreen[p];
+            b += iblue[p];
+            n++;
+          }
+        }
+        r /= n;
+        gr /= n;
+        b /= n;
+        float lum = (COEFF_YR * r + COEFF_YG * gr + COEFF_YB * b);
+        u[X] = r - lum;
+        v[X] = b - lum;
+        g[X] = lum;
+      }
+    }
+  }
+
+  // Perform a Median on YUV component.
+  if (side >= CHROMA_HISTOGRAM_RADIUS) {
+    wxMedianHistogram(U, U2, (int)(side + 0.5), hWidth, hHeight, hxa, hxb);
+    wxMedianHistogram(V, V2, (int)(side + 0.5), hWidth, hHeight, hxa, hxb);
+  }
+  else
+  #pragma omp parallel
+  {
+    float *vector = new float[fp->n];
+    float *lanes = new float[fp->n * MEDIAN_LANES];
+
+    #pragma omp for schedule(dynamic, CHROMA_BAND)
+    for (int Y = 0; Y < hHeight; Y++) {
+      float *u = U2 + (long)Y * hWidth;
+      float *v = V2 + (long)Y * hWidth;
+      for (int X = 0; X < hxa[Y]; X++) u[X] = v[X] = 0;
+      for (int X = hxb[Y]; X < hWidth; X++) u[X] = v[X] = 0;
+      median_row(fp, U + (long)Y * hWidth, u, Y, hWidth, hHeight, hxa[Y], hxb[Y], lanes, vector);
+      median_row(fp, V + (long)Y * hWidth, v, Y, hWidth, hHeight, hxa[Y], hxb[Y], lanes, vector);
+    }
+
+    delete[] vector;
+    delete[] lanes;
+  }
+
+  // Upsample guided by Y and transform back to RGB
+  #pragma omp parallel
+  {
+    float *U0 = new float[width];
+    float *V0 = new float[width];
+
+    #pragma omp for schedule(dynamic, CHROMA_BAND)
+    for (int y = 0; y < height; y++) {
+      int xa, xb;
+      exr_row_span(y, width, origWidth, origHeight, &xa, &xb);
+      const float *r = ired + (long)y * width;
+      const float *g = igreen + (long)y * width;
+      const float *b = iblue + (long)y * width;
+
+      // Nearest cell rows and their bilinear weights: 3/4 and 1/4
+      int Ya = (y & 1) ? y / 2 : y / 2 - 1;
+      float wy = (y & 1) ? 0.75f : 0.25f;
+      long q0 = (long)MAX(Ya, 0) * hWidth;
+      long q1 = (long)MIN(Ya + 1, hHeight - 1) * hWidth;
+
+      // Odd pixels lie between cells X and X + 1, even pixels between X - 1
+      // and X
+      int ia = MAX(xa, 1), ib = MAX(MIN(xb, width - 1), ia);
+      for (int X = ia / 2; X < ib / 2; X++) {
+        int x = 2 * X + 1;
+        guided_blend(r[x], g[x], b[x], Y2, U2, V2, q0, q1, wy, X, X + 1, 0.75f, U0 + x, V0 + x);
+      }
+      for (int X = (ia + 1) / 2; X < (ib + 1) / 2; X++) {
+        int x = 2 * X;
+        guided_blend(r[x], g[x], b[x], Y2, U2, V2, q0, q1, wy, X - 1, X, 0.25f, U0 + x, V0 + x);
+      }
+
+      // First and last pixels of the canvas, whose outer cells are off it
+      for (int x = xa; x < MIN(xb, ia); x++) {
+        guided_blend(r[x], g[x], b[x], Y2, U2, V2, q0, q1, wy, 0, 0, 0.25f, U0 + x, V0 + x);
+      }
+      for (int x = ib; x < xb; x++) {
+        int X = x / 2;
+        if (x & 1) guided_blend(r[x], g[x], b[x], Y2, U2, V2, q0, q1, wy, X, MIN(X + 1, hWidth - 1), 0.75f, U0 + x, V0 + x);
+        else guided_blend(r[x], g[x], b[x], Y2, U2, V2, q0, q1, wy, X - 1, X, 0.25f, U0 + x, V0 + x);
+      }
+
+      chroma_to_rgb_row(projflag, y, xa, xb, U0, V0, ired, igreen, iblue, ored, ogreen, oblue, width, mask);
+    }
+
+    delete[] U0;
+    delete[] V0;
+  }
+
+  delete[] U;
+  delete[] V;
+  delete[] Y2;
+  delete[] U2;
+  delete[] V2;
+  delete[] hxa;
+  delete[] hxb;
+}
+
+
 /**
  * \brief  Iterate median filter on chromatic components of the image
  *
+ * The YUV transform, the U and V medians, the transform back to RGB and the
+ * restoration of the CFA values are fused in one pass over bands of
+ * CHROMA_BAND rows. Each band computes U and V for its rows plus a halo of
+ * the footprint radius in a thread-local buffer; Y is recomputed where it is
+ * needed.
+ *
+ * From a radius of CHROMA_HISTOGRAM_RADIUS, where the disc first holds more
+ * samples than a median network takes, U and V are filtered instead with
+ * wxMedianHistogram() on whole planes; its cost does not depend on side.
+ * Its footprint is the square of half-size round(side), not the disc.
+ *
+ * With half set, U and V are filtered at half resolution and upsampled with
+ * luminance as the guide (see chromatic_median_half()); side is then in
+ * half-resolution pixels.
  *
  * @param[in]  ired, igreen, iblue  initial  image
  * @param[in]  iter  number of iteracions
@@ -852,6 +1247,8 @@ void demosaic_nlmeans(
  * @param[in]  side  median in a (2*side+1) x (2*side+1) window
  * @param[in]  projflag if not zero, values of the original CFA are kept
  * @param[in]  width, height size of the image
+ * @param[in]  mask  CFA mask
+ * @param[in]  half  filter the chromatic components at half resolution
  *
  */
 
@@ -869,104 +1266,99 @@ void chromatic_median(
   int width,
   int height,
   int origWidth,
-  int origHeight
+  int origHeight,
+  unsigned char *mask,
+  bool half
 ) {
   clock_t start_time, end_time;
-  clock_t stime_local, stime_iter;
+  clock_t stime_iter;
   double elapsed;
 
   fprintf(stderr, "%d iterations of chromatic median ...\n", iter);
 
-  int size = height * width;
-
-  // Auxiliary variables for computing chromatic components
-  float *Y = new float[size];
-  float *U = new float[size];
-  float *V = new float[size];
-  float *U0 = new float[size];
-  float *V0 = new float[size];
+  median_footprint fp;
+  median_footprint_init(&fp, side);
+  int halo = fp.radius;
 
   // For each iteration
   start_time = clock();
   for (int i = 1; i <= iter; i++) {
-    stime_local = stime_iter = clock();
-    fprintf(stderr, "  iteration %d:\n", i);
+    stime_iter = clock();
 
-    // Transform to YUV
-    wxRgb2Yuv(ired, igreen, iblue, Y, U, V, width, height, origWidth, origHeight);
-    end_time = clock();
-    elapsed = double(end_time - stime_local) / CLOCKS_PER_SEC;
-    fprintf(stderr, "    %6.3f seconds to run wxRgb2Yuv()\n", elapsed);
+    // Filter the result of the previous iteration
+    if (i > 1) {
+      wxCopy(ored, ired, width * height);
+      wxCopy(ogreen, igreen, width * height);
+      wxCopy(oblue, iblue, width * height);
+    }
 
-    // Perform a Median on YUV component.
-    // The filtered image U0 is copied back to U inside. So is V0 -> V.
-    stime_local = clock();
-    wxMedian(U, U0, side, 1, width, height, origWidth, origHeight);
-    end_time = clock();
-    elapsed = double(end_time - stime_local) / CLOCKS_PER_SEC;
-    fprintf(stderr, "    %6.3f seconds to run wxMedian(U, U0)\n", elapsed);
+    if (half) {
+      chromatic_median_half(projflag, &fp, side, ired, igreen, iblue, ored, ogreen, oblue, width, height, origWidth, origHeight, mask);
+    }
+    else if (side >= CHROMA_HISTOGRAM_RADIUS) {
+      chromatic_median_histogram(projflag, (int)(side + 0.5), ired, igreen, iblue, ored, ogreen, oblue, width, height, origWidth, origHeight, mask);
+    }
+    else
+    #pragma omp parallel
+    {
+      // Chromatic components of a band and its halo, and the filtered row
+      float *U = new float[(CHROMA_BAND + 2 * halo) * width];
+      float *V = new float[(CHROMA_BAND + 2 * halo) * width];
+      float *U0 = new float[width];
+      float *V0 = new float[width];
+      float *vector = new float[fp.n];
+      float *lanes = new float[fp.n * MEDIAN_LANES];
+
+      #pragma omp for schedule(dynamic)
+      for (int y0 = 0; y0 < height; y0 += CHROMA_BAND) {
+        int y1 = MIN(y0 + CHROMA_BAND, height);
+        int ya = MAX(y0 - halo, 0);
+        int yb = MIN(y1 + halo, height);
+
+        // Transform to YUV
+        for (int y = ya; y < yb; y++) {
+          float *u = U + (y - ya) * width;
+          float *v = V + (y - ya) * width;
+          int xa, xb;
+          exr_row_span(y, width, origWidth, origHeight, &xa, &xb);
+
+          for (int x = 0; x < xa; x++) u[x] = v[x] = 0;
+          for (int x = xb; x < width; x++) u[x] = v[x] = 0;
+          for (int x = xa; x < xb; x++) {
+            int p = y * width + x;
+            float Y = (COEFF_YR * ired[p] + COEFF_YG * igreen[p] + COEFF_YB * iblue[p]);
+            u[x] = (ired[p] - Y);
+            v[x] = (iblue[p] - Y);
+          }
+        }
 
-    stime_local = clock();
-    wxMedian(V, V0, side, 1, width, height, origWidth, origHeight);
-    end_time = clock();
-    elapsed = double(end_time - stime_local) / CLOCKS_PER_SEC;
-    fprintf(stderr, "    %6.3f seconds to run wxMedian(V, V0)\n", elapsed);
+        for (int y = y0; y < y1; y++) {
+          int xa, xb;
+          exr_row_span(y, width, origWidth, origHeight, &xa, &xb);
 
-    // Transform back to RGB
-    stime_local = clock();
-    wxYuv2Rgb(ored, ogreen, oblue, Y, U0, V0, width, height);
-    end_time = clock();
-    elapsed = double(end_time - stime_local) / CLOCKS_PER_SEC;
-    fprintf(stderr, "    %6.3f seconds to run wxYuv2Rgb()\n", elapsed);
-
-    // If projection flag is set, put back original CFA values
-    if (projflag) {
-      stime_local = clock();
-      for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-          int p = y * width + x;
-          if (
-              x + y >= origWidth - 1 and                   // NW edge
-              y > x - origWidth - 1 and                    // NE edge
-              x + y < origWidth + 2 * origHeight - 1 and   // SE edge
-              x > y - origWidth                            // SW edge
-             ) {
-            if (y % 2 == 0) {
-              ogreen[p] = igreen[p];
-            }
-            else {
-              if ((x + y - 1) % 4 == 0 || (x + y - 1) % 4 == 1) {
-                // cfamask[p] = REDPOSITION;
-                ored[p] = ired[p];
-              }
-              else {
-                oblue[p] = iblue[p];
-              }
-            }
-          }
+          // Perform a Median on YUV component.
+          median_row(&fp, U + (y - ya) * width, U0, y, width, height, xa, xb, lanes, vector);
+          median_row(&fp, V + (y - ya) * width, V0, y, width, height, xa, xb, lanes, vector);
+
+          // Transform back to RGB
+          chroma_to_rgb_row(projflag, y, xa, xb, U0, V0, ired, igreen, iblue, ored, ogreen, oblue, width, mask);
         }
       }
-      end_time = clock();
-      elapsed = double(end_time - stime_local) / CLOCKS_PER_SEC;
-      fprintf(stderr, "    %6.3f seconds to restore CFA values\n", elapsed);
-    }
 
-    wxCopy(ored, ired, size);
-    wxCopy(ogreen, igreen, size);
-    wxCopy(oblue, iblue, size);
+      delete[] U;
+      delete[] V;
+      delete[] U0;
+      delete[] V0;
+      delete[] vector;
+      delete[] lanes;
+    }
 
     end_time = clock();
     elapsed = double(end_time - stime_iter) / CLOCKS_PER_SEC;
-    fprintf(stderr, "    ---------\n");
-    fprintf(stderr, "     %6.3f seconds\n", elapsed);
+    fprintf(stderr, "  iteration %d: %6.3f seconds\n", i, elapsed);
   }
 
-  // delete auxiliary memory
-  delete[] Y;
-  delete[] U;
-  delete[] U0;
-  delete[] V;
-  delete[] V0;
+  median_footprint_free(&fp);
 
   end_time = clock();
   elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
@@ -974,6 +1366,78 @@ void chromatic_median(
 }
 
 
+long chroma_final_scratch(const chroma_final *cf, int rows) {
+  // U and V of the rows and their halo, a filtered row of each, and the
+  // median scratch
+  return 2L * (rows + 2 * cf->fp.radius) * cf->width + 2L * cf->width + cf->fp.n * (MEDIAN_LANES + 1);
+}
+
+
+void chroma_final_rect(const chroma_final *cf, int xa, int ya, int xb, int yb, float *red, float *green, float *blue, int stride, float *scratch) {
+  int width = cf->width, height = cf->height, halo = cf->fp.radius;
+  int ua = MAX(ya - halo, 0), ub = MIN(yb + halo, height);
+  int ca = MAX(xa - halo, 0), cb = MIN(xb + halo, width);
+  long rows = yb - ya + 2 * halo;
+  float *U = scratch;
+  float *V = U + rows * width;
+  float *U0 = V + rows * width;
+  float *V0 = U0 + width;
+  float *vector = V0 + width;
+  float *lanes = vector + cf->fp.n;
+
+  // Transform to YUV, in the columns the medians reach
+  for (int y = ua; y < ub; y++) {
+    float *u = U + (long)(y - ua) * width;
+    float *v = V + (long)(y - ua) * width;
+    int sa, sb;
+    exr_row_span(y, width, cf->origWidth, cf->origHeight, &sa, &sb);
+
+    sa = MIN(MAX(sa, ca), cb);
+    sb = MIN(MAX(sb, sa), cb);
+
+    for (int x = ca; x < sa; x++) u[x] = v[x] = 0;
+    for (int x = sb; x < cb; x++) u[x] = v[x] = 0;
+    const float *ir = cf->red + (long)y * width;
+    const float *ig = cf->green + (long)y * width;
+    const float *ib = cf->blue + (long)y * width;
+    for (int x = sa; x < sb; x++) {
+      float Y = (COEFF_YR * ir[x] + COEFF_YG * ig[x] + COEFF_YB * ib[x]);
+      u[x] = (ir[x] - Y);
+      v[x] = (ib[x] - Y);
+    }
+  }
+
+  for (int y = ya; y < yb; y++) {
+    float *r = red + (long)(y - ya) * stride - xa;
+    float *g = green + (long)(y - ya) * stride - xa;
+    float *b = blue + (long)(y - ya) * stride - xa;
+    int sa, sb;
+    exr_row_span(y, width, cf->origWidth, cf->origHeight, &sa, &sb);
+    sa = MIN(MAX(sa, xa), xb);
+    sb = MIN(MAX(sb, sa), xb);
+
+    for (int x = xa; x < sa; x++) r[x] = g[x] = b[x] = 0;
+    for (int x = sb; x < xb; x++) r[x] = g[x] = b[x] = 0;
+    if (sa == sb) continue;
+
+    // Perform a Median on YUV component.
+    median_row(&cf->fp, U + (long)(y - ua) * width, U0, y, width, height, sa, sb, lanes, vector);
+    median_row(&cf->fp, V + (long)(y - ua) * width, V0, y, width, height, sa, sb, lanes, vector);
+
+    // Transform back to RGB
+    for (int x = sa; x < sb; x++) {
+      chroma_to_rgb(cf->projflag, y * width + x, U0[x], V0[x], cf->red, cf->green, cf->blue, cf->mask, r + x, g + x, b + x);
+    }
+  }
+}
+
+
+void chroma_final_free(chroma_final *cf) {
+  if (cf->deferred) median_footprint_free(&cf->fp);
+  cf->deferred = false;
+}
+
+
 /** \brief Demosaicking chain
  *
  *
@@ -1004,9 +1468,13 @@ void chromatic_median(
  *  sequence of h together with a color regularization step (median filtering
  *  on chromaticity components).
  *
+ *  * In the green-only mode, NL_h refines green alone; red and blue are
+ *  rebuilt from it by bilinear interpolation of the color differences.
+ *
  *
  * @param[in]  ired, igreen, iblue  initial  image
  * @param[out] ored, ogreen, oblue  filtered output
+ * @param[in]  opts  optional approximations (may be NULL)
  *
  */
 
@@ -1022,54 +1490,109 @@ void ssdd_demosaic_chain (
   int height,
   int origWidth,
   int origHeight,
-  unsigned char *mask
+  unsigned char *mask,
+  const ssdd_options *opts
 ) {
 
   ////////////////////////////////////////////// Process
 
   int dbloc = 7;
-  float side = 1.5;
+  float side = (opts and opts->chroma_radius > 0) ? opts->chroma_radius : 1.5;
   int iter = 1;
   int projflag = 1;
   float threshold = 200; // presumably the original code was used with 8-bit images
 
+  // Approximate NLM: the first pass records the best candidates, the
+  // following passes re-weight only those.
+  bool green_only = opts and opts->green_only;
+  bool half_chroma = opts and opts->half_chroma;
+
+  nlm_graph *graph = NULL;
+  if (opts and opts->nlm_graph_k > 0) {
+    if (dbloc > NLM_GRAPH_MAX_RADIUS) {
+      fprintf(stderr, "neighbour graph offsets do not fit a %dx%d search block\n", 2 * dbloc + 1, 2 * dbloc + 1);
+      exit(EXIT_FAILURE);
+    }
+    graph = new nlm_graph;
+    graph->k = opts->nlm_graph_k;
+    graph->channels = green_only ? 1 : 2;
+    graph->radius = dbloc;
+    graph->filled = false;
+    graph->codes = new unsigned char[(size_t)width * height * graph->channels * graph->k];
+  }
+
   g_directional(threshold,     ired, igreen, iblue,  ored, ogreen, oblue,  width, height, origWidth, origHeight, mask);
   write_image("debayer.tiff",                        ored, ogreen, oblue,  width, height);
   //                                  ________________/      /      /
   //                                /      _________________/      /
   //                               /      /      _________________/
   //                              /      /      /
-  demosaic_nlmeans(dbloc, 16,  ored, ogreen, oblue,  ired, igreen, iblue,  width, height, origWidth, origHeight, mask);
+  demosaic_nlmeans(dbloc, 16,  ored, ogreen, oblue,  ired, igreen, iblue,  width, height, origWidth, origHeight, mask, green_only, graph);
+  if (green_only) bilinear_red_blue(ired, igreen, iblue, width, height, origWidth, origHeight, mask);
   write_image("nlmeans-16.tiff",                     ired, igreen, iblue,  width, height);
   //                                            ______/      /      /
   //                                           /      ______/      /
   //                                          /      /      ______/
   //                                         /      /      /
-  chromatic_median(iter, projflag, side,  ired, igreen, iblue,  ored, ogreen, oblue,  width, height, origWidth, origHeight);
+  chromatic_median(iter, projflag, side,  ired, igreen, iblue,  ored, ogreen, oblue,  width, height, origWidth, origHeight, mask, half_chroma);
   write_image("median-16.tiff",                                 ored, ogreen, oblue,  width, height);
   //                                  ________________/      /      /
   //                                /      _________________/      /
   //                               /      /      _________________/
   //                              /      /      /
-  demosaic_nlmeans(dbloc, 4,   ored, ogreen, oblue,  ired, igreen, iblue,  width, height, origWidth, origHeight, mask);
+  demosaic_nlmeans(dbloc, 4,   ored, ogreen, oblue,  ired, igreen, iblue,  width, height, origWidth, origHeight, mask, green_only, graph);
+  if (green_only) bilinear_red_blue(ired, igreen, iblue, width, height, origWidth, origHeight, mask);
   write_image("nlmeans-4.tiff",                      ired, igreen, iblue,  width, height);
   //                                            ______/      /      /
   //                                           /      ______/      /
   //                                          /      /      ______/
   //                                         /      /      /
-  chromatic_median(iter, projflag, side,  ired, igreen, iblue,  ored, ogreen, oblue,  width, height, origWidth, origHeight);
+  chromatic_median(iter, projflag, side,  ired, igreen, iblue,  ored, ogreen, oblue,  width, height, origWidth, origHeight, mask, half_chroma);
   write_image("median-4.tiff",                                  ored, ogreen, oblue,  width, height);
   //                                  ________________/      /      /
   //                                /      _________________/      /
   //                               /      /      _________________/
   //                              /      /      /
-  demosaic_nlmeans(dbloc, 1,   ored, ogreen, oblue,  ired, igreen, iblue,  width, height, origWidth, origHeight, mask);
+  demosaic_nlmeans(dbloc, 1,   ored, ogreen, oblue,  ired, igreen, iblue,  width, height, origWidth, origHeight, mask, green_only, graph);
+  if (green_only) bilinear_red_blue(ired, igreen, iblue, width, height, origWidth, origHeight, mask);
   write_image("nlmeans-1.tiff",                      ired, igreen, iblue,  width, height);
   //                                            ______/      /      /
   //                                           /      ______/      /
   //                                          /      /      ______/
   //                                         /      /      /
-  chromatic_median(iter, projflag, side,  ired, igreen, iblue,  ored, ogreen, oblue,  width, height, origWidth, origHeight);
-  write_image("median-1.tiff",                                  ored, ogreen, oblue,  width, height);
+  chroma_final *final = opts ? opts->final : NULL;
+  if (final) {
+    final->deferred = false;
+    median_footprint_init(&final->fp, side);
+    bool defer = iter == 1 and not half_chroma and side < CHROMA_HISTOGRAM_RADIUS;
+#ifdef DUMP_STAGES
+    defer = false; // median-1.tiff is written from the whole canvas
+#endif
+    if (defer) {
+      // The caller evaluates the last median where it needs it
+      final->deferred = true;
+      final->projflag = projflag;
+      final->red = ired;
+      final->green = igreen;
+      final->blue = iblue;
+      final->mask = mask;
+      final->width = width;
+      final->height = height;
+      final->origWidth = origWidth;
+      final->origHeight = origHeight;
+    }
+    else {
+      median_footprint_free(&final->fp);
+    }
+  }
+  if (not (final and final->deferred)) {
+    chromatic_median(iter, projflag, side,  ired, igreen, iblue,  ored, ogreen, oblue,  width, height, origWidth, origHeight, mask, half_chroma);
+    write_image("median-1.tiff",                                  ored, ogreen, oblue,  width, height);
+  }
+
+  if (graph) {
+    delete[] graph->codes;
+    delete graph;
+  }
 }
 
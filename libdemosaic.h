@@ -34,6 +34,8 @@
 
 #include "libAuxiliary.h"
 
+struct exr_stencil;
+
 /**
  * @file   libdemosaic.cpp
  * @brief  Demosaicking functions: HAmilton-Adams algorithm, NLmeans based demosaicking, Chromatic components filtering
@@ -73,6 +75,90 @@ void g_directional(
 );
 
 
+/**
+ * \brief  Green at the red and blue sites of the EXR edge band
+ *
+ * The sites within 4 pixels of the diamond edges (see exr_green_interior())
+ * get the inverse distance weighted average of their green neighbours.
+ *
+ * @param[in,out]  ogreen  green plane, raw at the green sites
+ * @param[in]  width, height size of the image
+ * @param[in]  origWidth, origHeight original image size
+ *
+ */
+void exr_green_edges(
+  float *ogreen,
+  int width,
+  int height,
+  int origWidth,
+  int origHeight,
+  unsigned char* mask
+);
+
+// The same for one odd row y; ogreen and mask point to the row, and the
+// rows y - 1 and y + 1 must be readable at a stride of width.
+void exr_green_edges_row(
+  float *ogreen,
+  const unsigned char *mask,
+  int y,
+  int width,
+  int origWidth,
+  int origHeight
+);
+
+
+/**
+ * \brief  Bilinear interpolation of red and blue on the EXR lattice
+ *
+ * Fills in the missing red and blue with the stencils of exr_stencil.h.
+ * The planes may hold the colors themselves or their differences with
+ * green.
+ *
+ * @param[in,out]  ored, oblue  planes, raw at their own sites
+ * @param[in]  width, height size of the image
+ * @param[in]  origWidth, origHeight original image size
+ * @param[in]  green_red  interior stencils of red at green sites, by phase:
+ *                 EXR_GREEN_RED, or EXR_GREEN_RED_DIAGONAL as in linear
+ *
+ */
+void exr_red_blue(
+  float *ored,
+  float *oblue,
+  int width,
+  int height,
+  int origWidth,
+  int origHeight,
+  unsigned char* mask,
+  const exr_stencil *green_red
+);
+
+// exr_red_blue() one row y at a time, for the streaming interpolation. The
+// pointers are to the row, and the rows within 3 of it must be readable at
+// a stride of width. exr_red_blue_row() fills in the interior of the row;
+// exr_red_blue_band_row() the edge band, once the interior of the rows up
+// to y + 2 and the bands of the rows above y are done.
+void exr_red_blue_row(
+  float *red,
+  float *blue,
+  int y,
+  int width,
+  int origWidth,
+  int origHeight,
+  const exr_stencil *green_red
+);
+
+void exr_red_blue_band_row(
+  float *red,
+  float *blue,
+  const unsigned char *mask,
+  int y,
+  int width,
+  int origWidth,
+  int origHeight,
+  const exr_stencil *green_red
+);
+
+
 /**
  * \brief  Classical bilinear interpolation of red and blue differences with the green channel
  *
@@ -95,6 +181,32 @@ void bilinear_red_blue(
 
 
 
+/**
+ * \brief  Neighbour graph cached between NLmeans passes
+ *
+ * For each pixel, the first pass keeps the offsets of the k most similar
+ * candidates of each interpolated channel, two of them, or green alone in
+ * the green-only mode. Later passes re-weight only those candidates instead
+ * of the whole search block.
+ *
+ * Offsets are coded in one byte as (dy + radius) * (2·radius + 1) + (dx + radius),
+ * so the search radius may not exceed 7.
+ *
+ */
+
+#define NLM_GRAPH_EMPTY 255
+#define NLM_GRAPH_MAX_RADIUS 7
+
+struct nlm_graph {
+  int k;                // candidates kept per interpolated channel
+  int channels;         // interpolated channels: 2, or 1 if only green is
+  int radius;           // search radius the codes refer to
+  bool filled;          // set by the pass that recorded the candidates
+  unsigned char *codes; // channels·k offset codes per pixel
+};
+
+
+
 /**
  * \brief  NLmeans based demosaicking
  *
@@ -106,6 +218,8 @@ void bilinear_red_blue(
  * @param[in]  bloc  research block of size (2+bloc+1) x (2*bloc+1)
  * @param[in]  h kernel bandwidth
  * @param[in]  width, height size of the image
+ * @param[in]  green_only  if true, only the green channel is interpolated; red and blue keep their input values
+ * @param[in,out]  graph  if not NULL, candidates are recorded in it on the first pass and re-weighted on later passes
  *
  */
 
@@ -123,7 +237,9 @@ void demosaic_nlmeans(
   int height,
   int origWidth,
   int origHeight,
-  unsigned char* mask
+  unsigned char* mask,
+  bool green_only,
+  nlm_graph *graph
 );
 
 
@@ -138,14 +254,92 @@ void demosaic_nlmeans(
  * @param[in]  side  median in a (2*side+1) x (2*side+1) window
  * @param[in]  projflag if not zero, values of the original CFA are kept
  * @param[in]  width, height size of the image
+ * @param[in]  mask  CFA mask, used to restore the original CFA values
+ *
+ */
+
+
+
+void chromatic_median(
+  int iter,
+  int projflag,
+  float side,
+  float *ired,
+  float *igreen,
+  float *iblue,
+  float *ored,
+  float *ogreen,
+  float *oblue,
+  int width,
+  int height,
+  int origWidth,
+  int origHeight,
+  unsigned char* mask,
+  bool half
+);
+
+
+
+
+/**
+ * \brief  Last chromatic median of the chain, evaluated on demand
+ *
+ * The last pass of the chain only feeds the output. When it is a single
+ * iteration of the median network at full resolution, every rectangle of
+ * its result only depends on its input in the rectangle and a halo of the
+ * footprint radius, so the chain can leave it to the caller, who evaluates
+ * it with chroma_final_rect() only where and when the output needs it.
+ * Nothing is deferred when the stages are dumped (DUMP_STAGES), since
+ * median-1.tiff is written from the whole canvas.
+ *
+ */
+
+struct chroma_final {
+  bool deferred;          // set by the chain if the last median was left to the caller
+  int projflag;
+  median_footprint fp;
+  const float *red, *green, *blue;   // input of the last median
+  const unsigned char *mask;
+  int width, height, origWidth, origHeight;
+};
+
+/**
+ * \brief  Scratch floats needed by chroma_final_rect() for rectangles of up to rows rows
  *
  */
 
+long chroma_final_scratch(const chroma_final *cf, int rows);
 
+/**
+ * \brief  Evaluate the last chromatic median on a rectangle of the canvas
+ *
+ * @param[in]   cf  deferred last median
+ * @param[in]   xa, ya, xb, yb  the rectangle xa <= x < xb, ya <= y < yb
+ * @param[out]  red, green, blue  its result, row y at (y - ya) * stride;
+ *                                pixels outside of the diamond are blank
+ * @param       scratch  chroma_final_scratch(cf, yb - ya) floats
+ *
+ */
+
+void chroma_final_rect(const chroma_final *cf, int xa, int ya, int xb, int yb, float *red, float *green, float *blue, int stride, float *scratch);
+
+void chroma_final_free(chroma_final *cf);
 
-void chromatic_median(int iter,int ,int projflag,float side,float *ired,float *igreen, float *iblue,float *ored,float *ogreen,float *oblue,int width,int height);
 
 
+/**
+ * \brief  Tunable modes of the demosaicking chain
+ *
+ */
+
+struct ssdd_options {
+  int nlm_graph_k;   // if > 0, passes after the first re-weight only this many candidates per channel
+  bool green_only;   // refine only green by NLM, rebuild red and blue from it by bilinear_red_blue()
+  float chroma_radius; // radius of the chromatic median; the default 1.5 is used if not positive
+  bool half_chroma;  // run the chromatic median on U and V downsampled by 2
+  chroma_final *final; // if not NULL, the last chromatic median may be left to the caller
+};
+
 
 
 /**
@@ -172,6 +366,7 @@ void chromatic_median(int iter,int ,int projflag,float side,float *ired,float *i
  * @param[in]  ired, igreen, iblue  initial  image
  * @param[out] ored, ogreen, oblue  filtered output
  * @param[in]  width, height size of the image
+ * @param[in]  opts  optional approximations
  *
  */
 
@@ -187,7 +382,8 @@ void ssdd_demosaic_chain(
   int height,
   int origWidth,
   int origHeight,
-  unsigned char* mask
+  unsigned char* mask,
+  const ssdd_options *opts
 );
 
 #endif
@@ -12,21 +12,21 @@
 #include "cfa_mask.h"
 #include "io_tiff.h"
 #include "write_tiff.h"
-#include "libAuxiliary.h" // wxCopy()
-
-#define DIAG 1.4142136
-#define DIAG12 2.236 // sqrt(5)
+#include "libAuxiliary.h" // canvas_alloc(), mirror_index()
+#include "libdemosaic.h" // exr_green_edges_row(), exr_red_blue()
+#include "exr_stencil.h"
+#include "exr_merge.h"
 
 using namespace std;
 using namespace termcolor;
 
+#define STREAM_BAND 16 // rows interpolated at a time in the streaming mode
+#define STREAM_KEEP 10 // rows of the streaming window kept for the next band
+
 void interpolate_hires_linear (
-  float *ired,
-  float *igreen,
-  float *iblue,
-  float *ored,
-  float *ogreen,
-  float *oblue,
+  float *red,
+  float *green,
+  float *blue,
   int width,
   int height,
   int cfaWidth,
@@ -35,840 +35,818 @@ void interpolate_hires_linear (
 );
 
 void interpolate_subframe_linear (
-  float *ired,
-  float *igreen,
-  float *iblue,
-  float *ored,
-  float *ogreen,
-  float *oblue,
+  const uint16 *const *cfa,
+  int frames,
+  bool average,
+  uint16 *out,
   int cfaWidth,
-  int cfaHeight,
-  unsigned char *mask
+  int cfaHeight
 );
 
+static void hires_linear (const struct arg_linear &args);
+static void subframe_linear (const struct arg_linear &args);
+static void stream_hires_linear (const struct arg_linear &args);
+static void stream_subframe_linear (const struct arg_linear &args);
+static void preview_linear (const struct arg_linear &args);
+
 // --------------------------------------------------------------------
 void run_linear (struct argp_state* state) {
   PARSE_ARGS_LINEAR;
 
-  clock_t start_time, end_time;
-  double elapsed;
-
-  size_t nx0 = 0, ny0 = 0;
-  size_t nx1 = 0, ny1 = 0;
-  char *description;
-  unsigned long cfaWidth;
-  unsigned long cfaHeight;
-  unsigned long width, height;
-  float *frame0, *frame1;
-  float *data_in, *data_out;
-  float *out_ptr, *end_ptr;
-  ushort *u_data_out;
-  bool landscape;
-  unsigned long i, x0, x1, y;
-
   cerr.setf(ios::fixed, ios::floatfield);
 
-  /* TIFF 16-bit grayscale -> float input */
-  start_time = clock();
-  {
-    if (args.interlaced_cfa) {
-      cerr << grey << "input file 0: " << white << args.input_file_0 << reset << endl;
-      if (NULL == (frame0 = read_tiff_gray16_f32(args.input_file_0, &nx0, &ny0, &description))) {
-        cerr << on_red << "error while reading from " << args.input_file_0 << reset << endl;
-        exit(EXIT_FAILURE);
-      }
+  if (args.preview) {
+    preview_linear(args);
+  }
+  else if (args.interlaced_cfa) {
+    if (args.stream) {
+      stream_hires_linear(args);
+    }
+    else {
+      hires_linear(args);
+    }
+  }
+  else {
+    if (args.stream) {
+      stream_subframe_linear(args);
+    }
+    else {
+      subframe_linear(args);
+    }
+  }
 
-      cerr << grey << "input file 1: " << white << args.input_file_1 << reset << endl;
-      if (NULL == (frame1 = read_tiff_gray16_f32(args.input_file_1, &nx1, &ny1, &description))) {
-        cerr << on_red << "error while reading from " << args.input_file_1 << reset << endl;
-        exit(EXIT_FAILURE);
-      }
-      if (nx0 != nx1 or ny0 != ny1) {
-        cerr << on_red << "Input frames must have identical geometry. Got "
-          << bold << nx0 << reset << on_red << "×" << bold << ny0 << reset
-          << on_red << " and "
-          << bold << nx1 << reset << on_red << "×" << bold << ny1 << reset
-          << endl;
-        exit(EXIT_FAILURE);
-      }
+  exit(EXIT_SUCCESS);
 
-      cfaWidth = nx0;
-      cfaHeight = ny0;
-      width = height = cfaWidth + cfaHeight;
+} // run_linear()
 
-      if (NULL == (data_in = (float *) malloc(sizeof(float) * width * height * 3))) {
-        cerr << on_red << "allocation error: not enough memory" << reset << endl;
-        exit(EXIT_FAILURE);
-      }
 
-      for (i = 0; i < width * height * 3; i++) {
-        data_in[i] = 0;
-      }
+// Orientation of the frames to be merged
+static exr_orientation frame_orientation(const struct arg_linear &args, size_t nx, size_t ny) {
+  exr_orientation orient;
+
+  if (not exr_orientation_init(&orient, args.orientation, nx, ny)) {
+    cerr << on_red << "unsupported orientation " << args.orientation << reset << endl;
+    exit(EXIT_FAILURE);
+  }
+  cerr << grey << "orientation: " << white << orient.exif << reset << endl;
+  return orient;
+}
+
+
+// Clip a row of the three planes to 0-65535 and convert it to chunked 16-bit
+// samples, as written by run_linear()
+static void chunk_row(const float *r, const float *g, const float *b, ushort *out, long width) {
+  const float *plane[3] = {r, g, b};
+  for (int c = 0; c < 3; c++) {
+    for (long x = 0; x < width; x++) {
+      float v = plane[c][x];
+      if (0 > v) v = 0;
+      if (65535 < v) v = 65535;
+      out[x * 3 + c] = v;
     }
-    else {
-      cerr << grey << "input file 0: " << white << args.input_file_0 << reset << endl;
-      if (NULL == (data_in = read_tiff_gray16_f32(args.input_file_0, &nx0, &ny0, &description))) {
-        cerr << on_red << "error while reading from " << args.input_file_0 << reset << endl;
-        exit(EXIT_FAILURE);
-      }
+  }
+}
 
-      frame0 = frame1 = data_in; // to avoid -Wmaybe-uninitialized
 
-      width = cfaWidth = nx0;
-      height = cfaHeight = ny0;
-    }
+static tiff_stream *open_output(const char *fname, long width, long height, int bits) {
+  tiff_stream *ts;
+  cerr << grey << "writing output to " << white << fname << reset << endl;
+  if (NULL == (ts = write_tiff_open(fname, width, height, bits, 3))) {
+    cerr << on_red << "error while writing to " << fname << reset << endl;
+    exit(EXIT_FAILURE);
+  }
+  return ts;
+}
+
 
-    landscape = cfaWidth > cfaHeight ? true : false;
+static void close_output(tiff_stream *ts, const char *fname) {
+  if (0 != write_tiff_close(ts)) {
+    cerr << on_red << "error while writing to " << fname << reset << endl;
+    exit(EXIT_FAILURE);
   }
+}
+
+
+/**
+ * \brief  One row of the merged EXR matrix, with its CFA mask
+ *
+ * The row is merged by exr_merge_row() into the green plane, and copied
+ * to the red and blue ones, to be replaced by the interpolation where it
+ * is not of their color. In the rows past the canvas, all is blank.
+ *
+ */
+static void merged_row(
+  const exr_frame_pairs<uint16> &pairs,
+  float *r,
+  float *g,
+  float *b,
+  unsigned char *mask,
+  long y,
+  long width,
+  long height,
+  const exr_orientation &orient
+) {
+  exr_cfa_mask_row(mask, y < height ? y : -1, width, orient.ow, orient.oh);
+  exr_merge_row(pairs, g, y, orient);
+  memcpy(r, g, width * sizeof(float));
+  memcpy(b, g, width * sizeof(float));
+}
+
+
+/**
+ * \brief  Merge and interpolate two EXR frames
+ *
+ * The frames are merged directly into the output planes, which are
+ * interpolated in place.
+ *
+ */
+static void hires_linear (const struct arg_linear &args) {
+  clock_t start_time, end_time;
+  double elapsed;
+  uint16 *frame0, *frame1;
+  size_t nx = 0, ny = 0;
+
+  /* TIFF 16-bit grayscale input */
+  start_time = clock();
+  read_tiff_gray16_frames(args.input_file_0, args.input_file_1, &frame0, &frame1, &nx, &ny);
   end_time = clock();
   elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
   cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " reading input" << reset << endl;
 
+  exr_orientation orient = frame_orientation(args, nx, ny);
+  long width = nx + ny, height = width;
 
-  if (NULL == (data_out = (float *) malloc(sizeof(float) * width * height * 3))) {
+  float *data_out;
+  if (NULL == (data_out = canvas_alloc(width, height, 3))) {
     cerr << on_red << "allocation error: not enough memory" << reset << endl;
     exit(EXIT_FAILURE);
   }
+  float *red = data_out, *green = data_out + width * height, *blue = data_out + 2 * width * height;
+  unsigned char *mask = new unsigned char[width * height];
 
-  if (args.interlaced_cfa) {
-    start_time = clock();
-    for (i = 0; i < (unsigned long)cfaWidth * cfaHeight; i++) {
-      if (landscape) {
-        //
-        // B........G
-        // ..........
-        // ..........
-        // G........R
-        //
-        x0 = i % cfaWidth + (unsigned long)(i / cfaWidth);
-        x1 = x0 + 1; // the second frame (fn == 1) is shifted 1px to the right
-        y = (cfaWidth - i % cfaWidth - 1) + (i / cfaWidth);
-        data_in[y * width + x0] = frame0[i];
-        data_in[y * width + x1] = frame1[i];
-        data_in[y * width + x0 + width * height] = frame0[i];
-        data_in[y * width + x1 + width * height] = frame1[i];
-        data_in[y * width + x0 + width * height * 2] = frame0[i];
-        data_in[y * width + x1 + width * height * 2] = frame1[i];
-      }
-      else {
-        // Portrait 270° CW
-        //
-        //  G.....R
-        //  .......
-        //  .......
-        //  .......
-        //  B.....G
-        //
-        x0 = cfaHeight - 1 + i % cfaWidth - (unsigned long)(i / cfaWidth);
-        x1 = x0 + 1; // the second frame (fn == 1) is shifted 1px to the right
-        y = i % cfaWidth + (unsigned long)(i / cfaWidth);
-        data_in[y * width + x0] = frame0[i];
-        data_in[y * width + x1] = frame1[i];
-        data_in[y * width + x0 + width * height] = frame0[i];
-        data_in[y * width + x1 + width * height] = frame1[i];
-        data_in[y * width + x0 + width * height * 2] = frame0[i];
-        data_in[y * width + x1 + width * height * 2] = frame1[i];
-      }
-    }
-    end_time = clock();
-    elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
-    cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " merging input frames" << reset << endl;
-
-    start_time = clock();
-    unsigned char *mask = exr_cfa_mask(width, height, cfaWidth, cfaHeight);
-    end_time = clock();
-    elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
-    cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " computing the CFA mask" << reset << endl;
-
-    start_time = clock();
-    interpolate_hires_linear (
-      data_in,
-      data_in + width * height,
-      data_in + 2 * width * height,
-      data_out,
-      data_out + width * height,
-      data_out + 2 * width * height,
-      (int) width,
-      (int) height,
-      landscape ? cfaWidth : cfaHeight,
-      landscape ? cfaHeight : cfaWidth,
-      mask
-    );
-
-    delete[] mask;
-    end_time = clock();
-    elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
-    cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " interpolating" << reset << endl;
-  } // Interlaced HR Bayer
-
-  else { // interpolate one BGGR subframe
-    start_time = clock();
-    unsigned char *mask = bggr_cfa_mask(width, height);
-    end_time = clock();
-    elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
-    cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " computing the CFA mask" << reset << endl;
-
-    start_time = clock();
-    interpolate_subframe_linear (
-      data_in,
-      data_in + width * height,
-      data_in + 2 * width * height,
-      data_out,
-      data_out + width * height,
-      data_out + 2 * width * height,
-      (int)width,
-      (int)height,
-      mask
-    );
-
-    delete[] mask;
-    end_time = clock();
-    elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
-    cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " interpolating" << reset << endl;
-  }
-
-  /* limit to 0-65535 */
   start_time = clock();
-  {
-    // Clip out-of range values that may have been left from interpolation
-    out_ptr = data_out;
-    end_ptr = out_ptr + 3 * width * height;
-    while (out_ptr < end_ptr) {
-      if ( 0 > *out_ptr)
-        *out_ptr = 0;
-      if ( 65535 < *out_ptr)
-        *out_ptr = 65535;
-      out_ptr++;
-    }
+  exr_frame_pairs<uint16> pairs = { frame0, frame1 };
+  #pragma omp parallel for schedule(dynamic, MERGE_BAND)
+  for (long y = 0; y < height; y++) {
+    long o = y * width;
+    merged_row(pairs, red + o, green + o, blue + o, mask + o, y, width, height, orient);
   }
+  delete[] frame0;
+  delete[] frame1;
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " merging input frames" << reset << endl;
+
+  start_time = clock();
+  interpolate_hires_linear (
+    red,
+    green,
+    blue,
+    width,
+    height,
+    orient.ow,
+    orient.oh,
+    mask
+  );
+  delete[] mask;
   end_time = clock();
   elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
-  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " clipping values" << reset << endl;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " interpolating" << reset << endl;
 
   cerr << grey << "writing output to " << white << args.output_file << reset << endl;
   start_time = clock();
   {
     // Not using libtiff to write output because it creates invalid TIFF directories.
 
-    // Convert from planar to chunked
-    if (NULL == (u_data_out = (ushort *) malloc(sizeof(float) * width * height * 3))) {
-      cerr << on_red << "allocation error: not enough memory" << reset << endl;
-      exit(EXIT_FAILURE);
-    }
-    for (unsigned x = 0; x < width; x++) {
-      for (unsigned y = 0; y < height; y++) {
-        unsigned p = y * width + x;
-        u_data_out[y * 3 * width + x * 3] = data_out[p];
-        u_data_out[y * 3 * width + x * 3 + 1] = data_out[p + width * height];
-        u_data_out[y * 3 * width + x * 3 + 2] = data_out[p + 2 * width * height];
-      }
+    // Clip out-of range values that may have been left from interpolation,
+    // and convert from planar to chunked
+    ushort *u_data_out = new ushort[3 * width * height];
+    #pragma omp parallel for schedule(static)
+    for (long y = 0; y < height; y++) {
+      long o = y * width;
+      chunk_row(red + o, green + o, blue + o, u_data_out + 3 * o, width);
     }
+    canvas_free(data_out, width);
+
     write_tiff_img(args.output_file, (unsigned char *)u_data_out, width, height, 16, 3, 0 /* chunked */);
+    delete[] u_data_out;
   }
   end_time = clock();
   elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
   cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " writing" << reset << endl;
+} // hires_linear()
 
-  free(data_in);
-  free(data_out);
-  free(u_data_out);
 
-  exit(EXIT_SUCCESS);
+/**
+ * \brief  Interpolate one BGGR frame, or the two frames of a DR or SN shot
+ *
+ */
+static void subframe_linear (const struct arg_linear &args) {
+  clock_t start_time, end_time;
+  double elapsed;
+  uint16 *frame[2] = {NULL, NULL};
+  size_t width = 0, height = 0;
+  int frames = args.input_file_1 ? 2 : 1;
+  bool average = frames == 2 and not args.output_file_1;
+
+  /* TIFF 16-bit grayscale input */
+  start_time = clock();
+  if (frames == 2) {
+    read_tiff_gray16_frames(args.input_file_0, args.input_file_1, &frame[0], &frame[1], &width, &height);
+  }
+  else {
+    frame[0] = read_tiff_gray16_frame("input file 0", args.input_file_0, &width, &height);
+  }
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " reading input" << reset << endl;
+
+  if (width < 2 or height < 2) {
+    cerr << on_red << "The input frame must be at least 2×2" << reset << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  start_time = clock();
+  size_t size = 3 * width * height;
+  uint16 *u_data_out = new uint16[(average ? 1 : frames) * size];
+  interpolate_subframe_linear(frame, frames, average, u_data_out, width, height);
+  delete[] frame[0];
+  delete[] frame[1];
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " interpolating" << reset << endl;
+
+  start_time = clock();
+  cerr << grey << "writing output to " << white << args.output_file << reset << endl;
+  write_tiff_img(args.output_file, (unsigned char *)u_data_out, width, height, 16, 3, 0 /* chunked */);
+  if (frames == 2 and not average) {
+    cerr << grey << "writing output to " << white << args.output_file_1 << reset << endl;
+    write_tiff_img(args.output_file_1, (unsigned char *)(u_data_out + size), width, height, 16, 3, 0 /* chunked */);
+  }
+  delete[] u_data_out;
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " writing" << reset << endl;
+} // subframe_linear()
 
-} // run_linear()
 
+// Green in an odd row y of the EXR matrix. The sites within 4 pixels of the
+// diamond edges are interpolated by inverse distance weighting, and in the
+// rest of the row green is the mean of the vertical neighbours.
+static inline void green_row_linear(float *ogreen, const unsigned char *mask, int y, int width, int cfaWidth, int cfaHeight) {
+  int xa, xb, ia, ib;
+  exr_green_edges_row(ogreen, mask, y, width, cfaWidth, cfaHeight);
 
+  exr_row_span(y, width, cfaWidth, cfaHeight, &xa, &xb);
+  exr_green_interior(y, xa, xb, cfaWidth, cfaHeight, &ia, &ib);
+  for (int x = ia; x < ib; x++) {
+    ogreen[x] = (ogreen[x - width] + ogreen[x + width]) / 2.0;
+  }
+}
+
+
+/**
+ * \brief  Linear interpolation of the merged EXR matrix, in place
+ *
+ * @param[in,out]  red, green, blue  planes holding the raw sample of each
+ *                 site, allocated by canvas_alloc()
+ *
+ */
 void interpolate_hires_linear (
-  float *ired,
-  float *igreen,
-  float *iblue,
-  float *ored,
-  float *ogreen,
-  float *oblue,
+  float *red,
+  float *green,
+  float *blue,
   int width,
   int height,
   int cfaWidth,
   int cfaHeight,
   unsigned char *mask
 ) {
-  long x, y, p;
-
-  wxCopy(ired, ored, width * height);
-  wxCopy(igreen, ogreen, width * height);
-  wxCopy(iblue, oblue, width * height);
-
-  // Interpolate the green channel in the 4-pixel-wide boundary by inverse
-  // distance weighting.
-  for (x = 0; x < width; x++) {
-    for (y = 0; y < height; y++) {
-      p = y * width + x;
-      if (
-        (
-         mask[p] == BLUEPOSITION ||
-         mask[p] == REDPOSITION
-        )
-        &&
-        (
-         x + y < cfaWidth + 3 ||                    // NW boundary
-         x >= y + cfaWidth - 3 ||                   // NE boundary
-         x + y >= cfaWidth + 2 * cfaHeight - 5 ||  // SE boundary
-         y >= x + cfaWidth - 4                      // SW boundary
-        )
-      ) {
-        float avg = 0;
-        float weight = 0;
-        int
-          n = (y - 1) * width + x,
-          s = (y + 1) * width + x,
-          ne = (y - 1) * width + x + 1,
-          se = (y + 1) * width + x + 1,
-          sw = (y + 1) * width + x - 1,
-          nw = (y - 1) * width + x - 1;
-
-        // East and west corners are special cases because
-        // in the east corner the [ne] and [se] pixels are undefined,
-        // and in the west corner the [nw] and [sw] pixels are undefined
-        // and cannot be tested.
-        if (x == 0) { // West corner red
-          ogreen[p] = (ogreen[ne] + ogreen[se]) / 2;
-        }
-        else if (x == width - 1) { // East corner blue
-          ogreen[p] = (ogreen[nw] + ogreen[sw]) / 2;
-        }
-        else {
-          // Each non-green pixel is surrounded by 6 green pixels,
-          // except on the boundaries.
-          //
-          // G G G
-          //   *
-          // G G G
-          //
-          if (mask[nw] != BLANK) {
-            avg += ogreen[nw] / DIAG;
-            weight += 1 / DIAG;
-          }
-          if (mask[n] != BLANK) {
-            avg += ogreen[n];
-            weight += 1;
-          }
-          if (mask[ne] != BLANK) {
-            avg += ogreen[ne] / DIAG;
-            weight += 1 / DIAG;
-          }
-
-          if (mask[sw] != BLANK) {
-            avg += ogreen[sw] / DIAG;
-            weight += 1 / DIAG;
-          }
-          if (mask[s] != BLANK) {
-            avg += ogreen[s];
-            weight += 1;
-          }
-          if (mask[se] != BLANK) {
-            avg += ogreen[se] / DIAG;
-            weight += 1 / DIAG;
-          }
-          ogreen[p] = avg / weight;
-        }
-      }
+  // Green is missing only in the odd rows
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int y = 1; y < height; y += 2) {
+    green_row_linear(green + y * width, mask + y * width, y, width, cfaWidth, cfaHeight);
+  }
+  cerr << termcolor::green << "green " << grey << "channel interpolated" << endl;
+
+  // Interpolate red and blue making the average of possible values in
+  // location-dependent patterns (see exr_stencil.h)
+  exr_red_blue(red, blue, width, height, cfaWidth, cfaHeight, mask, EXR_GREEN_RED_DIAGONAL);
+  cerr << termcolor::blue << " blue " << grey << "channel interpolated" << endl;
+  cerr << termcolor::red << "  red " << grey << "channel interpolated" << endl;
+
+} // interpolate_hires_linear();
+
+
+/**
+ * \brief  Bilinear interpolation of one BGGR site, in fixed point
+ *
+ * The rows of the site and of its neighbours are passed separately, and the
+ * neighbouring columns as indices, so that the edges can pass their mirrored
+ * ghost cells (see mirror_index()) and share the interior stencils. All
+ * stencils read raw sites only. The sums of two or four 16-bit samples are
+ * exact in 32 bits, and the shifts truncate the means as the conversion of
+ * float means to 16 bits would.
+ *
+ * @param[out]  out  chunked RGB row
+ *
+ */
+static inline void subframe_site(
+  const uint16 *cn,
+  const uint16 *c,
+  const uint16 *cs,
+  uint16 *out,
+  long x,
+  long xw,
+  long xe,
+  long y
+) {
+  uint32_t
+    vertical = (uint32_t)cn[x] + cs[x],
+    horizontal = (uint32_t)c[xw] + c[xe],
+    diagonal = (uint32_t)cn[xw] + cn[xe] + cs[xw] + cs[xe];
+  uint16 *o = out + 3 * x;
+
+  if ((x + y) % 2) { // green
+    o[1] = c[x];
+    if (x % 2) { // odd column, blue row
+      o[0] = vertical >> 1;
+      o[2] = horizontal >> 1;
     }
+    else { // even column, red row
+      o[0] = horizontal >> 1;
+      o[2] = vertical >> 1;
+    }
+  }
+  else {
+    o[1] = (vertical + horizontal) >> 2;
+    if (y % 2) { // red
+      o[0] = c[x];
+      o[2] = diagonal >> 2;
+    }
+    else { // blue
+      o[0] = diagonal >> 2;
+      o[2] = c[x];
+    }
+  }
+}
+
+
+// n pairs of sites of an inner row of a BGGR frame, starting at the even
+// column x and stepping by two, so that the colors of each lane are fixed:
+// blue and green if the row is even, green and red if it is odd.
+template <int odd>
+static inline void subframe_pairs(const uint16 *cn, const uint16 *c, const uint16 *cs, uint16 *out, long xa, long n) {
+  #pragma omp simd
+  for (long k = 0; k < n; k++) {
+    long x = xa + 2 * k;
+    uint16 *o = out + 3 * x;
+    uint32_t
+      vertical0 = (uint32_t)cn[x] + cs[x],
+      vertical1 = (uint32_t)cn[x + 1] + cs[x + 1],
+      horizontal0 = (uint32_t)c[x - 1] + c[x + 1],
+      horizontal1 = (uint32_t)c[x] + c[x + 2];
+
+    if (odd) { // G R
+      o[0] = horizontal0 >> 1;
+      o[1] = c[x];
+      o[2] = vertical0 >> 1;
+      o[3] = c[x + 1];
+      o[4] = (vertical1 + horizontal1) >> 2;
+      o[5] = ((uint32_t)cn[x] + cn[x + 2] + cs[x] + cs[x + 2]) >> 2;
+    }
+    else { // B G
+      o[0] = ((uint32_t)cn[x - 1] + cn[x + 1] + cs[x - 1] + cs[x + 1]) >> 2;
+      o[1] = (vertical0 + horizontal0) >> 2;
+      o[2] = c[x];
+      o[3] = vertical1 >> 1;
+      o[4] = c[x + 1];
+      o[5] = horizontal1 >> 1;
+    }
+  }
+}
+
+
+// One row of a BGGR frame; cn and cs are the rows above and below it, or
+// their mirrored ghosts. The ghost columns are resolved only at the two
+// ends of the row.
+static void subframe_row(const uint16 *cn, const uint16 *c, const uint16 *cs, uint16 *out, long y, long width) {
+  long pairs = width > 4 ? (width - 3) / 2 : 0; // the pairs at 2, 4, .. whose neighbours are all inside
+  long x;
+
+  for (x = 0; x < 2; x++) {
+    subframe_site(cn, c, cs, out, x, mirror_index(x - 1, width), mirror_index(x + 1, width), y);
+  }
+  if (y % 2) {
+    subframe_pairs<1>(cn, c, cs, out, 2, pairs);
+  }
+  else {
+    subframe_pairs<0>(cn, c, cs, out, 2, pairs);
+  }
+  for (x = 2 + 2 * pairs; x < width; x++) {
+    subframe_site(cn, c, cs, out, x, mirror_index(x - 1, width), mirror_index(x + 1, width), y);
   }
+}
 
-  // -------------------------------------------------------
-  // Do simple linear interpolation for green inside the image
-  // -------------------------------------------------------
-  for (y = 0; y < height; y++) {
-    for (x = 0; x < width; x++) {
-      p = y * width + x;
-      if (
-          mask[p] != GREENPOSITION &&
-          x + y >= cfaWidth - 1 + 4 &&                   // NW boundary
-          y > x - cfaWidth - 1 + 4 &&                    // NE boundary
-          x + y < cfaWidth + 2 * cfaHeight - 1 - 4 &&   // SE boundary
-          x > y - cfaWidth + 4                           // SW boundary
-         ) {
-        int
-          n = (y - 1) * width + x,
-          s = (y + 1) * width + x;
-
-        ogreen[p] = (ogreen[n] + ogreen[s]) / 2.0;
+
+// The mean of two interpolated rows, truncated as the mean of two 16-bit
+// values in float would be
+static inline void average_row(uint16 *out, const uint16 *other, long n) {
+  #pragma omp simd
+  for (long i = 0; i < n; i++) {
+    out[i] = ((uint32_t)out[i] + other[i]) >> 1;
+  }
+}
+
+
+/**
+ * \brief  Bilinear interpolation of one or two BGGR frames
+ *
+ * The rows of all frames are shared out to the threads in one loop.
+ *
+ * @param[in]   cfa  raw frames
+ * @param[in]   frames  1 or 2
+ * @param[in]   average  write the mean of the two interpolated frames
+ * @param[out]  out  chunked RGB images, one after the other, or their mean
+ * @param[in]   width, height  size of the frames, at least 2×2
+ *
+ */
+void interpolate_subframe_linear (
+  const uint16 *const *cfa,
+  int frames,
+  bool average,
+  uint16 *out,
+  int width,
+  int height
+) {
+  if (average) {
+    #pragma omp parallel
+    {
+      uint16 *other = new uint16[3 * width];
+
+      #pragma omp for schedule(static)
+      for (long y = 0; y < height; y++) {
+        long yn = mirror_index(y - 1, height);
+        long ys = mirror_index(y + 1, height);
+        uint16 *row = out + 3 * y * width;
+
+        subframe_row(cfa[0] + yn * width, cfa[0] + y * width, cfa[0] + ys * width, row, y, width);
+        subframe_row(cfa[1] + yn * width, cfa[1] + y * width, cfa[1] + ys * width, other, y, width);
+        average_row(row, other, 3 * width);
+      }
+
+      delete[] other;
+    }
+  }
+  else {
+    #pragma omp parallel for collapse(2) schedule(static)
+    for (int f = 0; f < frames; f++) {
+      for (long y = 0; y < height; y++) {
+        long yn = mirror_index(y - 1, height);
+        long ys = mirror_index(y + 1, height);
+        const uint16 *c = cfa[f];
+
+        subframe_row(c + yn * width, c + y * width, c + ys * width, out + (f * height + y) * 3 * width, y, width);
       }
     }
   }
   cerr << green << "green " << grey << "channel interpolated" << endl;
+  cerr << blue << " blue " << grey << "channel interpolated" << endl;
+  cerr << red << "  red " << grey << "channel interpolated" << endl;
 
-  // Interpolate blue making the average of possible values in
-  // location-dependent patterns (different for G and R locations)
-  for (x = 0; x < width; x++) {
-    for (y = 0; y < height; y++) {
-      p = y * width + x;
-      if (mask[p] != BLUEPOSITION && mask[p] != BLANK) {
-        int
-          n = (y - 1) * width + x,
-          s = (y + 1) * width + x,
-          e = p + 1,
-          w = p - 1,
-          e2 = p + 2,
-          w2 = p - 2,
-          ne = (y - 1) * width + x + 1,
-          se = (y + 1) * width + x + 1,
-          sw = (y + 1) * width + x - 1,
-          nw = (y - 1) * width + x - 1,
-          n2 = (y - 2) * width + x,
-          s2 = (y + 2) * width + x;
-
-        // First interpolate boundary values
-        if (x + y == cfaWidth - 1) {  // NW boundary
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average of the closest blue pixels.
-            //
-            //     B B . .
-            //   * e . . .
-            // B B . . B b
-            // . . . . . .
-            // . . b b . .
-            //
-            oblue[p] = (oblue[sw]/DIAG   + oblue[s]      + oblue[ne]/DIAG + oblue[ne + 1]/DIAG12) / (1/DIAG + 1 + 1/DIAG + 1/DIAG12);
-            oblue[e] = (oblue[sw]/DIAG12 + oblue[s]/DIAG + oblue[ne]      + oblue[ne + 1]/DIAG + oblue[se + 2]/DIAG12) / (1/DIAG12 + 1/DIAG + 1 + 1/DIAG + 1/DIAG12);
-          }
-        }
-        else if (y == x - cfaWidth) {  // NE boundary
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average the underlying red block to the inner green pixel
-            // (w) and copy it to the outer green pixel (*). All other blue
-            // pixels are too far to be useful.
-            //
-            // b b . .
-            // . . . w *
-            // . . B B . .
-            // . . . . . .
-            // b b . . b b
-            //
-            oblue[w] = (oblue[sw - 1]/DIAG + oblue[sw]) / (1 + 1/DIAG);
-            oblue[p] = oblue[w];
-          }
-          else { // REDPOSITION
-            // Each red block can be interpolated from the closest two blue blocks.
-            //
-            //  Inner       Outer
-            //
-            // . . .       . . .
-            // . B w *     . B - *
-            // . . | \ .   . . / | .
-            // . . B B .   . . B B .
-            // . . . . .   . . . . .
-            //
-            oblue[p] = (oblue[s2]/2 + oblue[s2 - 1]/DIAG12 + oblue[w2]/2) / (1 + 1 / DIAG12);
-            oblue[w] = (oblue[s2 - 1]/2 + oblue[s2]/DIAG12 + oblue[w2]) / (1.5 + 1 / DIAG12);
-          }
-        }
-        else if (y == x + cfaWidth - 1) {  // SW boundary
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average of the closest blue pixels.
-            //
-            // . . B B . .
-            // . . . . . .
-            // B B . . B B
-            //   * e . . .
-            //     B B . .
-            //
-            oblue[p] = (oblue[nw]/DIAG   + oblue[n]      + oblue[se]/DIAG + oblue[se + 1]/DIAG12) / (1/DIAG + 1 + 1/DIAG + 1/DIAG12);
-            oblue[e] = (oblue[nw]/DIAG12 + oblue[n]/DIAG + oblue[se]      + oblue[se + 1]/DIAG + oblue[ne + 2]/DIAG12) / (1/DIAG12 + 1/DIAG + 1 + 1/DIAG + 1/DIAG12);
-          }
-        }
-        else if (x + y == cfaWidth + 2 * cfaHeight - 2) {  // SE boundary
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average the overlying blue block to the inner green pixel
-            // (w) and copy it to the outer green pixel (*). All other blue
-            // pixels are too far to be useful.
-            //
-            // b b . . b b
-            // . . . . . .
-            // . . B B . .
-            // . . . w *
-            // b b . .
-            //
-            oblue[w] = (oblue[nw] + oblue[nw - 1] / DIAG) / (1 + 1 / DIAG);
-            oblue[p] = oblue[w];
-          }
-          else { // REDPOSITION
-            // Each red block can be interpolated from the closest two blue blocks.
-            //
-            //   Outer        Inner
-            //
-            // . . . . .    . . . . .
-            // . . B B .    . . B B .
-            // . . \ | .    . . | / .
-            // . B - *      . B w *
-            // . . .        . . .
-            //
-            oblue[p] = (oblue[n2] / 2 + oblue[n2 - 1] / DIAG12 + oblue[w2] / 2) / (1 + 1 / DIAG12);
-            oblue[w] = oblue[p];
-          }
-        }
+} // interpolate_subframe_linear();
 
-        // Now interpolate inside the image
-        else if ( // Green interior and east boundaries
-          mask[p] == GREENPOSITION &&
-          x + y >= cfaWidth - 1 + 2 &&  // exclude NW boundary (even though it should have filled right)
-          x > y - cfaWidth + 2 &&       // exclude SW boundary (even though it should have filled right)
-          y > x - cfaWidth - 1 + 2 &&                // exclude NE boundary
-          x + y < cfaWidth + 2 * cfaHeight - 1 - 2  // exclude SE boundary
-        ) {
-          // The interpolation pattern for green pixels depends on their horizontal position.
-          if ((x + y + 3) % 4 == 0) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // B B . . . . .
-            // . * . . . . .
-            // . . B . . . .
-            // . . . . . . .
-            //
-            oblue[p] = (oblue[nw] / DIAG + oblue[se] / DIAG + oblue[n]) / (1 + 2 / DIAG);
-          }
-          if ((x + y + 3) % 4 == 1) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . B . . . . .
-            // . . * . . . .
-            // . . B B . . .
-            // . . . . . . .
-            //
-            oblue[p] = (oblue[nw] / DIAG + oblue[se] / DIAG + oblue[s]) / (1 + 2 / DIAG);
-          }
-          if ((x + y + 3) % 4 == 2) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . . . . B . .
-            // . . . * . . .
-            // . . B B . . .
-            // . . . . . . .
-            //
-            oblue[p] = (oblue[ne] / DIAG + oblue[sw] / DIAG + oblue[s]) / (1 + 2 / DIAG);
-          }
-          if ((x + y + 3) % 4 == 3) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . . . . B B .
-            // . . . . * . .
-            // . . . B . . .
-            // . . . . . . .
-            //
-            oblue[p] = (oblue[ne] / DIAG + oblue[sw] / DIAG + oblue[n]) / (1 + 2 / DIAG);
-          }
-        }
 
-        else if ( // Red interior (boundaries have already been excluded above)
-          mask[p] == REDPOSITION
-        ) {
-          if (x % 2 == 0) {
-            oblue[p] = (oblue[n2] / 2 + oblue[e2] / 2 + oblue[s2] / 2 + oblue[w]) / 2.5;
-          }
-          else {
-            oblue[p] = (oblue[n2] / 2 + oblue[e] + oblue[s2] / 2 + oblue[w2] / 2) / 2.5;
-          }
-        }
-      }
+// Open one or two frames of identical geometry for reading by scanlines
+static void open_frames(const char *const *input, int frames, TIFF **fp, size_t *width, size_t *height) {
+  for (int f = 0; f < frames; f++) {
+    size_t nx, ny;
+    cerr << grey << "input file " << f << ": " << white << input[f] << reset << endl;
+    if (NULL == (fp[f] = open_tiff_gray16(input[f], &nx, &ny, NULL))) {
+      cerr << on_red << "error while reading from " << input[f] << reset << endl;
+      exit(EXIT_FAILURE);
+    }
+    if (f > 0) {
+      check_frame_geometry(*width, *height, nx, ny);
     }
+    *width = nx;
+    *height = ny;
   }
-  cerr << blue << " blue " << grey << "channel interpolated" << endl;
+}
 
 
-  // Interpolate red making the average of possible values in
-  // location-dependent patterns (different for G and B locations)
-  for (x = 0; x < width; x++) {
-    for (y = 0; y < height; y++) {
-      p = y * width + x;
-      if (mask[p] != REDPOSITION && mask[p] != BLANK) {
-        int
-          // n = (y - 1) * width + x,
-          // s = (y + 1) * width + x,
-          e = p + 1,
-          w = p - 1,
-          e2 = p + 2,
-          w2 = p - 2,
-          ne = (y - 1) * width + x + 1,
-          se = (y + 1) * width + x + 1,
-          sw = (y + 1) * width + x - 1,
-          nw = (y - 1) * width + x - 1,
-          n2 = (y - 2) * width + x,
-          s2 = (y + 2) * width + x;
-
-
-        // Do the boundaries
-        if (x + y == cfaWidth - 1) {  // NW boundary
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average the underlying red block to the inner green pixel
-            // (G) and copy it to the outer green pixel (*). All other red
-            // pixels are too far to be useful.
-            //
-            //     . . r r
-            //   * e . . .
-            // . . R R . .
-            // . . . . . .
-            // r r . . r r
-            //
-            ored[e] = (ored[se] + ored[se + 1] / DIAG) / (1 + 1 / DIAG);
-            ored[p] = ored[e];
-          }
-          else { // BLUEPOSITION
-            // Each blue block can be interpolated from the closest two red blocks.
-            //
-            //  Inner       Outer
-            //
-            //     . . .       . . .
-            //   * e R .     * - R .
-            // . / | . .   . | \ . .
-            // . R R . .   . R R . .
-            // . . . . .   . . . . .
-            //
-            ored[e] = (ored[s2] / DIAG12 + ored[s2 + 1] / 2 + ored[e2]) / (1.5 + 1 / DIAG12);
-            ored[p] = (ored[s2] / 2 + ored[s2 + 1] / DIAG12 + ored[e2] / 2) / (1 + 1 / DIAG12);
-          }
-        }
-        else if (x == y - cfaWidth + 1) { // SW boundary
-          if (mask[p] == GREENPOSITION) {
-            // IDW-average the overlying red block to the inner green pixel
-            // (e) and copy it to the outer green pixel (*). All other red
-            // pixels are too far to be useful.
-            //
-            // r r . . r r
-            // . . . . . .
-            // . . R R . .
-            //   * e . . .
-            //     . . r r
-            //
-            ored[e] = (ored[ne] + ored[ne + 1] / DIAG) / (1 + 1 / DIAG);
-            ored[p] = ored[e];
-          }
-          else { // BLUEPOSITION
-            // Each blue block can be interpolated from the closest two red blocks.
-            //
-            //   Outer        Inner
-            //
-            // . . . . .    . . . . .
-            // . R R . .    . R R . .
-            // . | / . .    . \ | . .
-            //   * - R .      * e R .
-            //     . . .        . . .
-            //
-            ored[p] = (ored[n2] / 2 + ored[n2 + 1] / DIAG12 + ored[e2] / 2) / (1 + 1 / DIAG12);
-            ored[e] = (ored[n2] / DIAG12 + ored[n2 + 1] / 2 + ored[e2]) / (1.5 + 1 / DIAG12);
-          }
-        }
+/**
+ * \brief  Interpolate one or two BGGR frames as they are read
+ *
+ * A ring of three input rows is kept for each frame: each output row is
+ * interpolated and written as soon as the row below it has been read.
+ *
+ */
+static void stream_subframe_linear (const struct arg_linear &args) {
+  clock_t start_time, end_time;
+  double elapsed;
+  size_t width = 0, height = 0;
+  int frames = args.input_file_1 ? 2 : 1;
+  bool average = frames == 2 and not args.output_file_1;
+  const char *input[2] = {args.input_file_0, args.input_file_1};
+  const char *output[2] = {args.output_file, args.output_file_1};
+  TIFF *fp[2];
 
-        // Do the interior
-        else if ( // Green interior and east boundaries
-          mask[p] == GREENPOSITION &&
-          x + y >= cfaWidth + 1 &&  // exclude NW boundary (it has been filled)
-          x > y - cfaWidth + 2      // exclude SW boundary (it has been filled)
-        ) {
-          // The interpolation pattern for green pixels depends on their horizontal position.
-          if ((x + y + 1) % 4 == 0) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // R . . . . . .
-            // . * . . . . .
-            // . . R . . . .
-            // . . . . . . .
-            //
-            ored[p] = (ored[nw] + ored[se]) / 2;
-          }
-          if ((x + y + 1) % 4 == 1) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . R . . . . .
-            // . . * . . . .
-            // . . . R . . .
-            // . . . . . . .
-            //
-            ored[p] = (ored[nw] + ored[se]) / 2;
-          }
-          if ((x + y + 1) % 4 == 2) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . . . . R . .
-            // . . . * . . .
-            // . . R . . . .
-            // . . . . . . .
-            //
-            ored[p] = (ored[ne] + ored[sw]) / 2;
-          }
-          if ((x + y + 1) % 4 == 3) {
-            //
-            //   0 1 2 3
-            // . . . . . . .
-            // . . . . . R .
-            // . . . . * . .
-            // . . . R . . .
-            // . . . . . . .
-            //
-            ored[p] = (ored[ne] + ored[sw]) / 2;
-          }
-        }
+  start_time = clock();
 
-        else if ( // Blue interior (blue does not occur on the west boundaries)
-          mask[p] == BLUEPOSITION &&
-          x + y >= cfaWidth + 2 and  // exclude NW boundary (even though it should have filled right)
-          x > y - cfaWidth + 2       // exclude SW boundary (even though it should have filled right)
-        ) {
-          if (x % 2 == 0) {
-            ored[p] = (ored[n2] / 2 + ored[e2] / 2 + ored[s2] / 2 + ored[w]) / 2.5;
-          }
-          else {
-            ored[p] = (ored[n2] / 2 + ored[e] + ored[s2] / 2 + ored[w2] / 2) / 2.5;
-          }
+  open_frames(input, frames, fp, &width, &height);
+  if (width < 2 or height < 2) {
+    cerr << on_red << "The input frame must be at least 2×2" << reset << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  uint16 *buf = (uint16 *) _TIFFmalloc(TIFFScanlineSize(fp[0]));
+  uint16 *ring = new uint16[frames * 3 * width];
+  uint16 *out = new uint16[frames * 3 * width];
+
+  tiff_stream *ts[2];
+  for (int f = 0; f < (average ? 1 : frames); f++) {
+    ts[f] = open_output(output[f], width, height, 16);
+  }
+
+  size_t next = 0; // next input row
+  for (size_t y = 0; y < height; y++) {
+    for (; next <= MIN(y + 1, height - 1); next++) {
+      for (int f = 0; f < frames; f++) {
+        if (0 != read_tiff_gray16_row(fp[f], next, buf)) {
+          cerr << on_red << "error while reading from " << input[f] << reset << endl;
+          exit(EXIT_FAILURE);
         }
+        memcpy(ring + (f * 3 + next % 3) * width, buf, width * sizeof(uint16));
+      }
+    }
+
+    long yn = mirror_index(y - 1, height);
+    long ys = mirror_index(y + 1, height);
+    for (int f = 0; f < frames; f++) {
+      const uint16 *r = ring + f * 3 * width;
+      subframe_row(r + (yn % 3) * width, r + (y % 3) * width, r + (ys % 3) * width, out + f * 3 * width, y, width);
+    }
+    if (average) {
+      average_row(out, out + 3 * width, 3 * width);
+    }
+
+    for (int f = 0; f < (average ? 1 : frames); f++) {
+      if (0 != write_tiff_rows(ts[f], (unsigned char *)(out + f * 3 * width), 1)) {
+        cerr << on_red << "error while writing to " << output[f] << reset << endl;
+        exit(EXIT_FAILURE);
       }
     }
   }
-  cerr << red << "  red " << grey << "channel interpolated" << endl;
+  for (int f = 0; f < (average ? 1 : frames); f++) {
+    close_output(ts[f], output[f]);
+  }
 
-} // interpolate_hires_linear();
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " reading, interpolating and writing" << reset << endl;
 
+  _TIFFfree(buf);
+  for (int f = 0; f < frames; f++) {
+    TIFFClose(fp[f]);
+  }
+  delete[] ring;
+  delete[] out;
+} // stream_subframe_linear()
+
+
+/**
+ * \brief  Merge and interpolate two EXR frames a band of rows at a time
+ *
+ * The rows of the merged matrix are diagonals of the frames, so the frames
+ * are kept in memory, but the float planes are only a window of the canvas.
+ * Each band of STREAM_BAND rows is merged into the window, and then, with
+ * the lags their stencils need:
+ *
+ *   green           rows up to 2 above the band   (reaches 1 row down)
+ *   red and blue    rows up to 3 above the band   (interior, 2 rows down)
+ *   edge bands      rows up to 6 above the band   (after the interior of
+ *                                                   the rows 3 below)
+ *
+ * and the rows whose edge bands are done are written. The edge bands are
+ * done row by row in the same order as by exr_red_blue(), so the output is
+ * the same as without streaming.
+ *
+ */
+static void stream_hires_linear (const struct arg_linear &args) {
+  clock_t start_time, end_time;
+  double elapsed;
+  uint16 *frame0, *frame1;
+  size_t nx = 0, ny = 0;
 
-void interpolate_subframe_linear (
-  float *ired,
-  float *igreen,
-  float *iblue,
-  float *ored,
-  float *ogreen,
-  float *oblue,
-  int width,
-  int height,
-  unsigned char *mask
-) {
-  long x, y, p;
-
-  wxCopy(ired, ored, width * height);
-  wxCopy(igreen, ogreen, width * height);
-  wxCopy(iblue, oblue, width * height);
-
-  // -------------------------------------------------
-  // Do simple linear interpolation in the green plane
-  // -------------------------------------------------
-  for (y = 0; y < height; y++) {
-    for (x = 0; x < width; x++) {
-      p = y * width + x;
-      if (mask[p] != GREENPOSITION) {
-        int
-          n = (y - 1) * width + x,
-          s = (y + 1) * width + x,
-          e = p + 1,
-          w = p - 1;
-
-        if (y == 0) { // N edge
-          if (x == 0) { // NW corner
-            ogreen[p] = (ogreen[e] + ogreen[s]) / 2.0;
-          }
-          else {
-            ogreen[p] = (ogreen[e] + ogreen[w]) / 2.0;
-          }
-        }
-        else if (x == 0 and y > 0) { // W edge
-          ogreen[p] = (ogreen[n] + ogreen[s]) / 2.0;
-        }
-        else { // interior
-          ogreen[p] = (ogreen[n] + ogreen[s] + ogreen[w] + ogreen[e]) / 4.0;
-        }
+  start_time = clock();
+  read_tiff_gray16_frames(args.input_file_0, args.input_file_1, &frame0, &frame1, &nx, &ny);
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " reading input" << reset << endl;
+
+  exr_orientation orient = frame_orientation(args, nx, ny);
+  long width = nx + ny, height = width;
+  int ow = orient.ow;
+  int oh = orient.oh;
+
+  // The window holds the canvas rows lo .. lo + rows - 1. It starts with
+  // blank rows above the canvas, as the stencils of the first rows reach
+  // past it.
+  long rows = STREAM_BAND + STREAM_KEEP;
+  long lo = STREAM_BAND - rows;
+  float *window;
+  if (NULL == (window = canvas_alloc(width, rows, 3))) {
+    cerr << on_red << "allocation error: not enough memory" << reset << endl;
+    exit(EXIT_FAILURE);
+  }
+  float *wr = window, *wg = window + rows * width, *wb = window + 2 * rows * width;
+  unsigned char *wmask = new unsigned char[rows * width];
+  ushort *u_out = new ushort[3 * width * STREAM_BAND];
+
+  tiff_stream *ts = open_output(args.output_file, width, height, 16);
+  exr_frame_pairs<uint16> pairs = { frame0, frame1 };
+
+  start_time = clock();
+  for (long band = 0; band - 6 < height; band += STREAM_BAND) {
+    // Slide the window
+    if (band + STREAM_BAND > lo + rows) {
+      long shift = band - STREAM_KEEP - lo;
+      memmove(wr, wr + shift * width, STREAM_KEEP * width * sizeof(float));
+      memmove(wg, wg + shift * width, STREAM_KEEP * width * sizeof(float));
+      memmove(wb, wb + shift * width, STREAM_KEEP * width * sizeof(float));
+      memmove(wmask, wmask + shift * width, STREAM_KEEP * width);
+      lo += shift;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (long y = band; y < band + STREAM_BAND; y++) {
+      long o = (y - lo) * width;
+      merged_row(pairs, wr + o, wg + o, wb + o, wmask + o, y, width, height, orient);
+    }
+
+    #pragma omp parallel for schedule(dynamic, 4)
+    for (long y = MAX(band - 2, 0); y < MIN(band + STREAM_BAND - 2, height); y++) {
+      long o = (y - lo) * width;
+      if (y % 2) {
+        green_row_linear(wg + o, wmask + o, y, width, ow, oh);
       }
     }
+
+    #pragma omp parallel for schedule(dynamic, 4)
+    for (long y = MAX(band - 3, 0); y < MIN(band + STREAM_BAND - 3, height); y++) {
+      long o = (y - lo) * width;
+      exr_red_blue_row(wr + o, wb + o, y, width, ow, oh, EXR_GREEN_RED_DIAGONAL);
+    }
+
+    long ya = MAX(band - 6, 0), yb = MIN(band + STREAM_BAND - 6, height);
+    for (long y = ya; y < yb; y++) {
+      long o = (y - lo) * width;
+      exr_red_blue_band_row(wr + o, wb + o, wmask + o, y, width, ow, oh, EXR_GREEN_RED_DIAGONAL);
+      chunk_row(wr + o, wg + o, wb + o, u_out + (y - ya) * 3 * width, width);
+    }
+    if (yb > ya and 0 != write_tiff_rows(ts, (unsigned char *)u_out, yb - ya)) {
+      cerr << on_red << "error while writing to " << args.output_file << reset << endl;
+      exit(EXIT_FAILURE);
+    }
   }
-  cerr << green << "green " << grey << "channel interpolated" << endl;
+  close_output(ts, args.output_file);
 
-  // Interpolate blue making the average of possible values in
-  // location-dependent patterns (different for G and R locations)
-  for (x = 0; x < width; x++) {
-    for (y = 0; y < height; y++) {
-      p = y * width + x;
-      if (mask[p] == GREENPOSITION) {
-        int
-          n = (y - 1) * width + x,
-          s = (y + 1) * width + x,
-          e = p + 1,
-          w = p - 1;
-
-        if (x == width - 1) {  // E edge
-          oblue[p] = oblue[w];
-        }
-        else if (y == height - 1) { // S edge
-          oblue[p] = oblue[n];
-        }
-        else if (x % 2) { // odd interior column
-          oblue[p] = (oblue[e] + oblue[w]) / 2.0;
-        }
-        else { // even interior column
-          oblue[p] = (oblue[n] + oblue[s]) / 2.0;
-        }
-      }
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " merging, interpolating and writing" << reset << endl;
+
+  delete[] frame0;
+  delete[] frame1;
+  canvas_free(window, width);
+  delete[] wmask;
+  delete[] u_out;
+} // stream_hires_linear()
+
+
+/**
+ * \brief  Box-filtered preview of one or two frames
+ *
+ * Merging the frames into the EXR matrix and rotating it back to its
+ * photographic orientation, as ssdd does, takes the frame pixel (row, col)
+ * to about (row, col) * √2 in the full resolution image, in either frame.
+ * The pixel (i, j) of a preview at 1/N of that resolution thus covers the
+ * frame rows and columns from i and j to i + 1 and j + 1 times N / √2, and
+ * gets the mean of the red, green and blue sites there in all frames. The
+ * frames are read row by row into column sums and are never merged, so
+ * nothing like the tilted canvas is held in memory. The colors of the
+ * sites follow from the orientation of the frames, given by -o.
+ *
+ * 16-bit samples are scaled to the full range by write_tiff_close(). An
+ * 8-bit preview gets the top 8 bits of the same scaled samples, so its
+ * 16-bit rows are kept until the maximum is known; the preview is small.
+ *
+ */
+static void preview_linear (const struct arg_linear &args) {
+  clock_t start_time, end_time;
+  double elapsed;
+  size_t width = 0, height = 0;
+  int frames = args.input_file_1 ? 2 : 1;
+  const char *input[2] = {args.input_file_0, args.input_file_1};
+  TIFF *fp[2];
+
+  start_time = clock();
 
-      if (mask[p] == REDPOSITION) {
-        int
-          ne = (y - 1) * width + x + 1,
-          se = (y + 1) * width + x + 1,
-          sw = (y + 1) * width + x - 1,
-          nw = (y - 1) * width + x - 1;
+  open_frames(input, frames, fp, &width, &height);
 
-        if (x == width - 1 or y == height - 1) {  // E and S edges
-          oblue[p] = oblue[nw];
+  double box = args.preview * sqrt(0.5); // frame pixels per preview pixel
+  long pw = width / box, ph = height / box;
+  if (pw < 1 or ph < 1) {
+    cerr << on_red << "The input frames are too small for a 1/" << args.preview << " preview" << reset << endl;
+    exit(EXIT_FAILURE);
+  }
+  cerr << grey << "preview: " << white << pw << grey << "×" << white << ph << reset << endl;
+
+  exr_orientation orient = frame_orientation(args, width, height);
+  int redx, redy;
+  exr_red_position(orient, &redx, &redy);
+
+  uint16 *buf = (uint16 *) _TIFFmalloc(TIFFScanlineSize(fp[0]));
+  uint32_t *sum = new uint32_t[3 * width];   // red, green and blue of each column
+  uint32_t *count = new uint32_t[3 * width];
+  bool keep = args.bits == 8;
+  uint16 *out = new uint16[3 * pw * (keep ? ph : 1)];
+  unsigned char *out8 = new unsigned char[3 * pw];
+
+  tiff_stream *ts = open_output(args.output_file, pw, ph, args.bits);
+
+  for (long i = 0; i < ph; i++) {
+    uint16 *o = keep ? out + 3 * pw * i : out;
+    memset(sum, 0, 3 * width * sizeof(uint32_t));
+    memset(count, 0, 3 * width * sizeof(uint32_t));
+
+    for (long y = (long)(i * box); y < (long)((i + 1) * box); y++) {
+      for (int f = 0; f < frames; f++) {
+        if (0 != read_tiff_gray16_row(fp[f], y, buf)) {
+          cerr << on_red << "error while reading from " << input[f] << reset << endl;
+          exit(EXIT_FAILURE);
         }
-        else { // interior
-          oblue[p] = (oblue[nw] + oblue[ne] + oblue[se] + oblue[sw]) / 4.0;
+        // Red and green in the rows of red, green and blue in the others;
+        // red and blue in the columns of red
+        bool redrow = y % 2 == redy;
+        int at = redrow ? 0 : 1, off = redrow ? 1 : 2;
+        for (size_t x = 0; x < width; x++) {
+          int c = (int)(x % 2) == redx ? at : off;
+          sum[3 * x + c] += buf[x];
+          count[3 * x + c]++;
         }
       }
     }
-  }
-  cerr << blue << " blue " << grey << "channel interpolated" << endl;
 
-  // Interpolate red making the average of possible values in
-  // location-dependent patterns (different for G and B locations)
-  for (x = 0; x < width; x++) {
-    for (y = 0; y < height; y++) {
-      p = y * width + x;
-      if (mask[p] == GREENPOSITION) {
-        int
-          n = (y - 1) * width + x,
-          s = (y + 1) * width + x,
-          e = p + 1,
-          w = p - 1;
-
-        if (x == 0) {  // W edge
-          ored[p] = ored[e];
-        }
-        else if (y == 0) { // N edge
-          ored[p] = ored[s];
-        }
-        else if (x % 2) { // odd interior column
-          ored[p] = (ored[e] + ored[w]) / 2.0;
-        }
-        else { // even interior column
-          ored[p] = (ored[n] + ored[s]) / 2.0;
+    for (long j = 0; j < pw; j++) {
+      uint32_t s[3] = {0, 0, 0}, n[3] = {0, 0, 0};
+      for (long x = (long)(j * box); x < (long)((j + 1) * box); x++) {
+        for (int c = 0; c < 3; c++) {
+          s[c] += sum[3 * x + c];
+          n[c] += count[3 * x + c];
         }
       }
+      for (int c = 0; c < 3; c++) {
+        o[3 * j + c] = s[c] / n[c];
+      }
+    }
+
+    if (not keep and 0 != write_tiff_rows(ts, (unsigned char *)o, 1)) {
+      cerr << on_red << "error while writing to " << args.output_file << reset << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
 
-      if (mask[p] == BLUEPOSITION) {
-        int
-          ne = (y - 1) * width + x + 1,
-          se = (y + 1) * width + x + 1,
-          sw = (y + 1) * width + x - 1,
-          nw = (y - 1) * width + x - 1;
+  if (keep) {
+    // The scale write_tiff_close() gives 16-bit samples
+    int mx = 0;
+    for (long k = 0; k < 3 * pw * ph; k++) {
+      mx = MAX(mx, out[k]);
+    }
+    int scale = mx > 0 ? 65535 / mx : 1;
 
-        if (x == 0 or y == 0) {  // W and N edges
-          ored[p] = ored[se];
-        }
-        else { // interior
-          ored[p] = (ored[nw] + ored[ne] + ored[se] + ored[sw]) / 4.0;
-        }
+    for (long i = 0; i < ph; i++) {
+      for (long k = 0; k < 3 * pw; k++) {
+        out8[k] = (scale * out[3 * pw * i + k]) >> 8;
+      }
+      if (0 != write_tiff_rows(ts, out8, 1)) {
+        cerr << on_red << "error while writing to " << args.output_file << reset << endl;
+        exit(EXIT_FAILURE);
       }
     }
   }
-  cerr << red << "  red " << grey << "channel interpolated" << endl;
+  close_output(ts, args.output_file);
 
-} // interpolate_subframe_linear();
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " reading, averaging and writing" << reset << endl;
+
+  _TIFFfree(buf);
+  for (int f = 0; f < frames; f++) {
+    TIFFClose(fp[f]);
+  }
+  delete[] sum;
+  delete[] count;
+  delete[] out;
+  delete[] out8;
+} // preview_linear()
@@ -5,12 +5,19 @@
 //
 struct arg_linear {
   bool interlaced_cfa;
+  bool stream;
+  int preview;
+  int bits;
+  int orientation;
   char* input_file_0;
   char* input_file_1;
   char* output_file;
+  char* output_file_1;
 };
 
-static char args_doc_linear[] = "[bayer.tiff | -x bayer_0.tiff bayer_1.tiff] output.tiff";
+static char args_doc_linear[] =
+  "[bayer.tiff | -x bayer_0.tiff bayer_1.tiff] output.tiff\n"
+  "bayer_0.tiff bayer_1.tiff [output.tiff | output_0.tiff output_1.tiff]";
 
 static char doc_linear[] =
 "\n"
@@ -27,8 +34,12 @@ static char doc_linear[] =
 "  The HR (high-resolution) images can be assembled from frames shot in any\n"
 "  mode, and in that case, the frames must be interpolated together."
 "\n"
+"  Without -x, the two frames of a DR or SN shot can be given at once.\n"
+"  They are interpolated separately, but in one pass.\n"
+"\n"
 "Output:\n"
-"  Interpolated TIFF image"
+"  Interpolated TIFF image, or, for two frames without -x, either\n"
+"  the mean of the two interpolated frames or each of them"
 "\n"
 "\v"
 "The algorithm proceeds as follows:\n"
@@ -38,6 +49,10 @@ static char doc_linear[] =
 "     EXR matrix. This step is not done in the case of a\n"
 "     single input frame."
 "\n"
+"     The frames are turned back to the orientation of the\n"
+"     sensor first, as given by -o (see `exiftool -Orientation\n"
+"     -n source.RAF`).\n"
+"\n"
 "  2. A simple linear interpolation with symmetrical unbiased\n"
 "     stencils is used to fill the missing pixels in each color\n"
 "     plane.\n"
@@ -47,11 +62,25 @@ static char doc_linear[] =
 "  frames shot in the SN mode), such transformations must precede\n"
 "  interpolation.\n"
 "\n"
+"  With -p N, no interpolation is done: a preview at 1/N of the\n"
+"  resolution of the EXR matrix rotated to its photographic\n"
+"  orientation (as done by ssdd) is made by averaging the sites\n"
+"  of each color of the frames in boxes of about N/√2 frame\n"
+"  pixels. The frames are read one scanline at a time into the\n"
+"  column sums of a row of boxes. The colors of the sites follow\n"
+"  from -o, as with -x, which is not given with -p.\n"
+"\n"
+"  With -s, the input is read, interpolated and written a band of\n"
+"  rows at a time, and only a few rows of the image are held in\n"
+"  memory (with -x, the input frames are held as 16-bit samples,\n"
+"  because the rows of the EXR matrix are their diagonals).\n"
+"\n"
 ;
 
 static error_t parse_linear_command(int key, char* arg, struct argp_state* state) {
   struct arg_linear* arguments = (struct arg_linear*)state->input;
   char **nonopt;
+  int rest;
 
   assert( arguments );
 
@@ -60,6 +89,31 @@ static error_t parse_linear_command(int key, char* arg, struct argp_state* state
       arguments->interlaced_cfa = true;
       break;
 
+    case 's':
+      arguments->stream = true;
+      break;
+
+    case 'p':
+      arguments->preview = atoi(arg);
+      if (arguments->preview < 3) {
+        argp_error(state, "The preview scale must be 3 or more");
+      }
+      break;
+
+    case 'b':
+      arguments->bits = atoi(arg);
+      if (arguments->bits != 8 and arguments->bits != 16) {
+        argp_error(state, "The preview can have 8 or 16 bits per sample");
+      }
+      break;
+
+    case 'o':
+      arguments->orientation = atoi(arg);
+      if (arguments->orientation != 1 and arguments->orientation != 3 and arguments->orientation != 6 and arguments->orientation != 8) {
+        argp_error(state, "Supported orientations are 1, 3, 6 and 8");
+      }
+      break;
+
     case ARGP_KEY_NO_ARGS:
       argp_usage (state);
 
@@ -67,6 +121,7 @@ static error_t parse_linear_command(int key, char* arg, struct argp_state* state
       // Here we know that state->arg_num == 0, since we force option parsing
       // to end before any non-option arguments can be seen
       nonopt = &state->argv[state->next];
+      rest = state->argc - state->next;
       state->next = state->argc; // we're done
 
       if (arguments->interlaced_cfa) {
@@ -74,6 +129,14 @@ static error_t parse_linear_command(int key, char* arg, struct argp_state* state
         arguments->input_file_1 = nonopt[0];
         arguments->output_file = nonopt[1];
       }
+      else if (rest >= 2) { // two frames
+        arguments->input_file_0 = arg;
+        arguments->input_file_1 = nonopt[0];
+        arguments->output_file = nonopt[1];
+        if (rest >= 3) {
+          arguments->output_file_1 = nonopt[2];
+        }
+      }
       else {
         arguments->input_file_0 = arg;
         arguments->output_file = nonopt[0];
@@ -81,6 +144,12 @@ static error_t parse_linear_command(int key, char* arg, struct argp_state* state
       break;
 
     case ARGP_KEY_END:
+      if (arguments->preview and arguments->output_file_1) {
+        argp_error(state, "A preview has one output");
+      }
+      if (arguments->preview and arguments->interlaced_cfa) {
+        argp_error(state, "A preview of two frames is made without -x");
+      }
       if (arguments->interlaced_cfa) {
         if (state->arg_num < 3) {
           argp_error(state, "Not enough arguments");
@@ -93,7 +162,7 @@ static error_t parse_linear_command(int key, char* arg, struct argp_state* state
         if (state->arg_num < 2) {
           argp_error(state, "Not enough arguments");
         }
-        if (state->arg_num > 2) {
+        if (state->arg_num > 4) {
           argp_error(state, "Extra arguments");
         }
       }
@@ -110,6 +179,10 @@ static error_t parse_linear_command(int key, char* arg, struct argp_state* state
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
 static struct argp_option options_linear[] = {
   {"highres-exr", 'x', 0, 0, "merge input frames into a tilted HR Bayer array" },
+  {"stream", 's', 0, 0, "stream the image through a few rows of memory" },
+  {"preview", 'p', "N", 0, "write a box-filtered preview at 1/N scale (e.g. 4 or 8) instead of interpolating" },
+  {"bits", 'b', "BITS", 0, "bits per sample of the preview, 8 or 16 (default 16)" },
+  {"orientation", 'o', "N", 0, "EXIF orientation of the frames merged with -x or previewed with -p: 1, 3, 6 or 8 (default 1 for landscape, 8 for portrait)" },
   { 0 }
 };
 
@@ -130,6 +203,12 @@ static struct argp argp_linear = {
   if (!argv[0]) argp_failure(state, 1, ENOMEM, 0); \
   sprintf(argv[0], "%s linear", state->name); \
   args.interlaced_cfa = false; \
+  args.stream = false; \
+  args.preview = 0; \
+  args.bits = 16; \
+  args.orientation = 0; \
+  args.input_file_1 = NULL; \
+  args.output_file_1 = NULL; \
   argp_parse(&argp_linear, argc, argv, ARGP_IN_ORDER, &argc, &args); \
   free(argv[0]); \
   argv[0] = argv0; \
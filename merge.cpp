@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <error.h>
+#include <ctime>
+#include <iostream>
+#include <iomanip>
+
+#include "merge_args.h"
+#include "termcolor.h"
+#include "io_tiff.h"
+#include "exr_merge.h"
+
+using namespace std;
+using namespace termcolor;
+
+// --------------------------------------------------------------------
+void run_merge (struct argp_state* state) {
+  PARSE_ARGS_MERGE;
+
+  clock_t start_time, end_time;
+  double elapsed;
+  uint16 *frame0, *frame1;
+  size_t nx = 0, ny = 0;
+
+  cerr.setf(ios::fixed, ios::floatfield);
+
+  /* TIFF 16-bit grayscale input */
+  start_time = clock();
+  read_tiff_gray16_frames(args.input_file_0, args.input_file_1, &frame0, &frame1, &nx, &ny);
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " reading input" << reset << endl;
+
+  exr_orientation orient;
+  if (not exr_orientation_init(&orient, args.orientation, nx, ny)) {
+    cerr << on_red << "unsupported orientation " << args.orientation << reset << endl;
+    exit(EXIT_FAILURE);
+  }
+  cerr << grey << "orientation: " << white << orient.exif << reset << endl;
+
+  // The samples go to the canvas as they are, each written once
+  start_time = clock();
+  long width = nx + ny;
+  uint16 *canvas = new uint16[width * width];
+  exr_frame_pairs<uint16> pairs = { frame0, frame1 };
+  exr_merge(pairs, canvas, orient);
+  delete[] frame0;
+  delete[] frame1;
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " merging input frames" << reset << endl;
+
+  cerr << grey << "writing output to " << white << args.output_file << reset << endl;
+  start_time = clock();
+  {
+    char description[100];
+    snprintf(description, sizeof(description), "width = %ld, height = %ld, orientation = %d", (long)nx, (long)ny, orient.exif);
+    if (0 != write_tiff_gray16(args.output_file, canvas, width, width, description)) {
+      cerr << on_red << "error while writing to " << args.output_file << reset << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  delete[] canvas;
+  end_time = clock();
+  elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
+  cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " writing" << reset << endl;
+} // run_merge()
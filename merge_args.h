@@ -0,0 +1,111 @@
+#include <argp.h>
+
+// -----------------------
+// ## merge command parser
+//
+struct arg_merge {
+  int orientation;
+  char* input_file_0;
+  char* input_file_1;
+  char* output_file;
+};
+
+static char args_doc_merge[] = "bayer_0.tiff bayer_1.tiff output.tiff";
+
+static char doc_merge[] =
+"\n"
+"Merge the two frames of an EXR image into the tilted EXR Bayer array\n"
+"\n"
+"Input:\n"
+"  Two raw Bayer frames extracted with dcraw from\n"
+"  an EXR image:\n"
+"\n"
+"    dcraw -v -w -d -s all -4 -T <source.RAF>\n"
+"\n"
+"Output:\n"
+"  16-bit grayscale TIFF image of the raw EXR array, with the\n"
+"  geometry of the frames and their orientation in its description:\n"
+"\n"
+"    width = W, height = H, orientation = N\n"
+"\n"
+"\v"
+"The frames are turned back to the orientation of the sensor, as\n"
+"given by -o (see `exiftool -Orientation -n source.RAF`), rotated\n"
+"45° CCW and interleaved, as done by ssdd and linear -x. The samples\n"
+"are written unchanged.\n"
+"\n"
+;
+
+static error_t parse_merge_command(int key, char* arg, struct argp_state* state) {
+  struct arg_merge* arguments = (struct arg_merge*)state->input;
+  char **nonopt;
+
+  assert( arguments );
+
+  switch(key) {
+    case 'o':
+      arguments->orientation = atoi(arg);
+      if (arguments->orientation != 1 and arguments->orientation != 3 and arguments->orientation != 6 and arguments->orientation != 8) {
+        argp_error(state, "Supported orientations are 1, 3, 6 and 8");
+      }
+      break;
+
+    case ARGP_KEY_NO_ARGS:
+      argp_usage (state);
+      break;
+
+    case ARGP_KEY_ARG: // non-option argument
+      // Here we know that state->arg_num == 0, since we force option parsing
+      // to end before any non-option arguments can be seen
+      nonopt = &state->argv[state->next];
+      state->next = state->argc; // we're done
+
+      arguments->input_file_0 = arg;
+      arguments->input_file_1 = nonopt[0];
+      arguments->output_file = nonopt[1];
+      break;
+
+    case ARGP_KEY_END:
+      if (state->arg_num < 3) {
+        argp_error(state, "Not enough arguments");
+      }
+      if (state->arg_num > 3) {
+        argp_error(state, "Extra arguments");
+      }
+      break;
+
+    default:
+      return ARGP_ERR_UNKNOWN;
+  }
+
+  return 0;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+static struct argp_option options_merge[] = {
+  {"orientation", 'o', "N", 0, "EXIF orientation of the frames: 1, 3, 6 or 8 (default 1 for landscape, 8 for portrait)" },
+  { 0 }
+};
+
+static struct argp argp_merge = {
+  options_merge,
+  parse_merge_command,
+  args_doc_merge,
+  doc_merge
+};
+#pragma GCC diagnostic pop
+
+#define PARSE_ARGS_MERGE \
+  struct arg_merge args; \
+  int    argc = state->argc - state->next + 1; \
+  char** argv = &state->argv[state->next - 1]; \
+  char*  argv0 =  argv[0]; \
+  argv[0] = (char *)malloc(strlen((char *)(state->name)) + strlen(" merge") + 1); \
+  if (!argv[0]) argp_failure(state, 1, ENOMEM, 0); \
+  sprintf(argv[0], "%s merge", state->name); \
+  args.orientation = 0; \
+  argp_parse(&argp_merge, argc, argv, ARGP_IN_ORDER, &argc, &args); \
+  free(argv[0]); \
+  argv[0] = argv0; \
+  state->next += argc - 1;
@@ -12,9 +12,6 @@
 #include "tiffio.h"
 #include "libAuxiliary.h"
 
-#define DIAG 1.4142136
-#define DIAG12 2.236 // sqrt(5)
-
 #define DUMP_STAGES
 #undef DEBUG_GREEN
 
@@ -163,6 +160,10 @@ void run_rotate (struct argp_state* state) {
   write_tiff_rgb_f32("mask.tiff", data_in, cfaWidth, cfaHeight);
   exit(0);
 
+  // Not reached: the bilinear rotation of the mask image as first ported
+  // from dcraw, kept for reference. The rotation of the demosaicked output,
+  // with the kernels of ssdd -s, is rotate_exr() in ssdd.cpp.
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-variable"
 #pragma GCC diagnostic ignored "-Wunused-but-set-variable"
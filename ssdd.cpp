@@ -46,12 +46,344 @@
 #include "io_tiff.h"
 #include "write_tiff.h"
 #include "libAuxiliary.h"
+#include "exr_merge.h"
 
 using namespace std;
 using namespace termcolor;
 
-#define DIAG 1.4142136
-#define DIAG12 2.236 // sqrt(5)
+#define ROTATE_TILE 64  // side of the target tiles rotated in parallel
+#define ROTATE_MEDIAN_ROWS 16 // canvas rows per work item of the deferred chromatic median
+
+// A target tile and the canvas rectangle under its taps
+struct rotate_job {
+  long ty, tx;              // top left pixel of the tile
+  int d0, s0;               // srow - scol + sensorWidth - 1 and srow + scol there
+  long rx0, ry0, rx1, ry1;  // the rectangle rx0 <= x < rx1, ry0 <= y < ry1
+};
+
+// Orientation of the frames, or of the frames the -x planes were merged from
+static void frame_orientation(exr_orientation *orient, int exif, long cfaWidth, long cfaHeight) {
+  if (not exr_orientation_init(orient, exif, cfaWidth, cfaHeight)) {
+    fprintf(stderr, "unsupported orientation %d\n", exif);
+    exit(EXIT_FAILURE);
+  }
+  fprintf(stderr, "orientation: %d\n", orient->exif);
+}
+
+
+/**
+ * \brief  Weight of a resampling kernel at the distance t from the sample
+ *
+ * @param[in]  taps  2 (bilinear), 4 (bicubic, Keys with a = -0.5) or 6
+ *                   (Lanczos-3)
+ *
+ */
+static double resample_weight(int taps, double t) {
+  t = fabs(t);
+  switch (taps) {
+    case 2:
+      return t < 1 ? 1 - t : 0;
+
+    case 4: {
+      const double a = -0.5;
+      if (t <= 1) return ((a + 2) * t - (a + 3)) * t * t + 1;
+      if (t < 2) return ((a * t - 5 * a) * t + 8 * a) * t - 4 * a;
+      return 0;
+    }
+
+    default:
+      if (t < 1e-8) return 1;
+      if (t >= 3) return 0;
+      return 3 * sin(M_PI * t) * sin(M_PI * t / 3) / (M_PI * M_PI * t * t);
+  }
+}
+
+
+/**
+ * \brief  Rotate one tile of the target with a kernel of N x N taps
+ *
+ * The taps of the target pixel are the rows ur[d] - N / 2 + 1 .. ur[d] + N / 2
+ * and the columns uc[s] - N / 2 + 1 .. uc[s] + N / 2 of the canvas, weighed
+ * by wr[d * N ..] and wc[s * N ..]. They are read from the rectangle of the
+ * canvas at (rx0, ry0), with a row stride of stride. Taps past the canvas
+ * are clamped to its edge. Kernels with negative lobes may overshoot and
+ * are clipped.
+ *
+ * The result goes to a chunked float tile of ROTATE_TILE x ROTATE_TILE,
+ * as it went to the float planes before: converting the sum straight to
+ * 16 bits lets -ffast-math evaluate it differently, and moves a few
+ * samples by 1.
+ *
+ */
+template <int N>
+static void rotate_tile(
+  const float *src,
+  float *dst,
+  long width,
+  long rx0,
+  long ry0,
+  long stride,
+  long ty,
+  long tyb,
+  long tx,
+  long txb,
+  int d0,
+  int s0,
+  int dr,
+  int sr,
+  int dd,
+  int ds,
+  const unsigned *ur,
+  const unsigned *uc,
+  const float *wr,
+  const float *wc
+) {
+  long plane = stride * stride;
+
+  for (long row = ty; row < tyb; row++) {
+    int d = d0 + (row - ty) * dr, s = s0 + (row - ty) * sr;
+    for (long col = tx; col < txb; col++, d += dd, s += ds) {
+      float *q = dst + ((row - ty) * ROTATE_TILE + col - tx) * 3;
+
+      // leave margins in the source image for the stencil
+      if (ur[d] > (unsigned)(width - 2) || uc[s] > (unsigned)(width - 2)) {
+        q[0] = q[1] = q[2] = 0;
+        continue;
+      }
+
+      long y0 = (long)ur[d] - N / 2 + 1, x0 = (long)uc[s] - N / 2 + 1;
+      const float *fr = wr + d * N, *fc = wc + s * N;
+
+      if (N == 2 or (y0 >= 0 and x0 >= 0 and y0 + N <= width and x0 + N <= width)) {
+        const float *pix = src + (y0 - ry0) * stride + (x0 - rx0);
+        for (int i = 0; i < 3; i++, pix += plane) {
+          float v = 0;
+          for (int k = 0; k < N; k++) {
+            float h = 0;
+            for (int j = 0; j < N; j++) {
+              h += fc[j] * pix[k * stride + j];
+            }
+            v += fr[k] * h;
+          }
+          if (N > 2) v = MIN(MAX(v, 0.0f), 65535.0f);
+          q[i] = v;
+        }
+        continue;
+      }
+
+      long yi[N], xi[N];
+      for (int k = 0; k < N; k++) {
+        yi[k] = (MIN(MAX(y0 + k, 0), width - 1) - ry0) * stride;
+        xi[k] = MIN(MAX(x0 + k, 0), width - 1) - rx0;
+      }
+      for (int i = 0; i < 3; i++) {
+        const float *pix = src + i * plane;
+        float v = 0;
+        for (int k = 0; k < N; k++) {
+          float h = 0;
+          for (int j = 0; j < N; j++) {
+            h += fc[j] * pix[yi[k] + xi[j]];
+          }
+          v += fr[k] * h;
+        }
+        v = MIN(MAX(v, 0.0f), 65535.0f);
+        q[i] = v;
+      }
+    }
+  }
+}
+
+
+/**
+ * \brief  Rotate the interpolated canvas 45° to the orientation of the frames
+ *
+ * The target pixel (row, col), taken back to the orientation of the sensor
+ * as (srow, scol), is resampled at
+ *
+ *   r = ow + (srow - scol) * √½,   c = (srow + scol) * √½
+ *
+ * in the canvas. The integer parts of r and c and the kernel weights for
+ * their fractions depend only on srow - scol and on srow + scol, and are
+ * tabulated once. The target is done in ROTATE_TILE x ROTATE_TILE tiles,
+ * in parallel. The canvas pixels a tile reads are a compact diamond; its
+ * bounding rectangle is brought to a buffer of the thread and limited to
+ * 0-65535 before resampling.
+ *
+ * The canvas is swept in bands of as many rows as the rectangles may span,
+ * and each band rotates the tiles whose rectangle ends in it. If the chain
+ * left its last chromatic median to the caller, each band first evaluates
+ * the median on its rows, once, into a ring of two bands, which holds all
+ * the rows its tiles read; the median result never exists as a whole
+ * canvas.
+ *
+ * @param[in]   cf   deferred last median of the chain, or NULL
+ * @param[in]   src  three canvas planes of width x width, if cf is not deferred
+ * @param[out]  dst  chunked 16-bit RGB target of rotWidth x rotHeight
+ * @param[in]   orient  orientation of the frames
+ * @param[in]   taps  2 (bilinear, David Coffin's stencil), 4 (bicubic) or
+ *                    6 (Lanczos-3)
+ *
+ */
+static void rotate_exr(const chroma_final *cf, const float *src, ushort *dst, long width, long rotWidth, long rotHeight, const exr_orientation &orient, int taps) {
+  double step = sqrt(0.5);
+  bool turned = orient.ow != orient.width;
+  int sensorWidth = turned ? rotHeight : rotWidth;
+  int sensorHeight = turned ? rotWidth : rotHeight;
+  bool deferred = cf and cf->deferred;
+
+  // ur and the row weights by srow - scol + sensorWidth - 1; uc and the
+  // column weights by srow + scol
+  int nd = sensorWidth + sensorHeight - 1;
+  unsigned *ur = new unsigned[nd], *uc = new unsigned[nd];
+  float *wr = new float[nd * taps], *wc = new float[nd * taps];
+  for (int i = 0; i < nd; i++) {
+    float r = orient.ow + (i - sensorWidth + 1) * step;
+    float c = i * step;
+    ur[i] = r;
+    uc[i] = c;
+    float fr = r - ur[i], fc = c - uc[i];
+    if (taps == 2) {
+      wr[i * 2] = 1 - fr;
+      wr[i * 2 + 1] = fr;
+      wc[i * 2] = 1 - fc;
+      wc[i * 2 + 1] = fc;
+      continue;
+    }
+    double sr = 0, sc = 0;
+    for (int k = 0; k < taps; k++) {
+      sr += wr[i * taps + k] = resample_weight(taps, k - taps / 2 + 1 - fr);
+      sc += wc[i * taps + k] = resample_weight(taps, k - taps / 2 + 1 - fc);
+    }
+    for (int k = 0; k < taps; k++) {
+      wr[i * taps + k] /= sr;
+      wc[i * taps + k] /= sc;
+    }
+  }
+
+  // srow - scol and srow + scol move by these along a target row and column
+  int dd = orient.src - orient.scc, ds = orient.src + orient.scc;
+  int dr = orient.srr - orient.scr, sr = orient.srr + orient.scr;
+
+  // Both srow - scol and srow + scol span 2 * (ROTATE_TILE - 1) over a tile
+  long side = (long)(2 * (ROTATE_TILE - 1) * step) + taps + 2;
+
+  // Canvas rectangle under the taps of each tile; ur and uc grow with their
+  // index, so it is set by the corners
+  long ntx = (rotWidth + ROTATE_TILE - 1) / ROTATE_TILE;
+  long nty = (rotHeight + ROTATE_TILE - 1) / ROTATE_TILE;
+  long tiles = ntx * nty;
+  rotate_job *jobs = new rotate_job[tiles];
+  for (long t = 0; t < tiles; t++) {
+    rotate_job *job = jobs + t;
+    long ty = job->ty = t / ntx * ROTATE_TILE;
+    long tx = job->tx = t % ntx * ROTATE_TILE;
+    int srow, scol;
+    exr_to_sensor(orient, (int)ty, (int)tx, sensorWidth, sensorHeight, &srow, &scol);
+    job->d0 = srow - scol + sensorWidth - 1;
+    job->s0 = srow + scol;
+    long tyb = MIN(ty + ROTATE_TILE, rotHeight), txb = MIN(tx + ROTATE_TILE, rotWidth);
+
+    int dy = (tyb - 1 - ty) * dr, dx = (txb - 1 - tx) * dd;
+    int sy = (tyb - 1 - ty) * sr, sx = (txb - 1 - tx) * ds;
+    int da = job->d0 + MIN(0, dy) + MIN(0, dx), db = job->d0 + MAX(0, dy) + MAX(0, dx);
+    int sa = job->s0 + MIN(0, sy) + MIN(0, sx), sb = job->s0 + MAX(0, sy) + MAX(0, sx);
+    job->ry0 = MAX((long)ur[da] - taps / 2 + 1, 0);
+    job->ry1 = MIN((long)ur[db] + taps / 2 + 1, width);
+    job->rx0 = MAX((long)uc[sa] - taps / 2 + 1, 0);
+    job->rx1 = MIN((long)uc[sb] + taps / 2 + 1, width);
+    if (job->ry0 >= job->ry1 or job->rx0 >= job->rx1) {
+      job->ry0 = job->ry1 = job->rx0 = job->rx1 = 0;
+    }
+  }
+
+  // Tiles by the band of side canvas rows their rectangle ends in
+  long bands = (width + side - 1) / side;
+  long *first = new long[bands + 1]();
+  long *next = new long[bands];
+  long *order = new long[tiles];
+  for (long t = 0; t < tiles; t++) {
+    first[MAX(jobs[t].ry1 - 1, 0) / side + 1]++;
+  }
+  for (long k = 0; k < bands; k++) {
+    first[k + 1] += first[k];
+    next[k] = first[k];
+  }
+  for (long t = 0; t < tiles; t++) {
+    order[next[MAX(jobs[t].ry1 - 1, 0) / side]++] = t;
+  }
+
+  // A rectangle spans at most two bands, the last two medians
+  long ringRows = 2 * side;
+  float *ring = deferred ? new float[3 * ringRows * width] : NULL;
+
+  #pragma omp parallel
+  {
+    float *rect = new float[3 * side * side];
+    float *tile = new float[3 * ROTATE_TILE * ROTATE_TILE];
+    float *scratch = deferred ? new float[chroma_final_scratch(cf, ROTATE_MEDIAN_ROWS)] : NULL;
+
+    for (long k = 0; k < bands; k++) {
+      if (deferred) {
+        long y1 = MIN((k + 1) * side, width);
+
+        #pragma omp for schedule(dynamic)
+        for (long y = k * side; y < y1; y += ROTATE_MEDIAN_ROWS) {
+          float *row = ring + y % ringRows * width;
+          long plane = ringRows * width;
+          chroma_final_rect(cf, 0, y, width, MIN(y + ROTATE_MEDIAN_ROWS, y1), row, row + plane, row + 2 * plane, width, scratch);
+        }
+      }
+
+      #pragma omp for schedule(dynamic)
+      for (long i = first[k]; i < first[k + 1]; i++) {
+        const rotate_job *job = jobs + order[i];
+        long ty = job->ty, tx = job->tx;
+        long tyb = MIN(ty + ROTATE_TILE, rotHeight), txb = MIN(tx + ROTATE_TILE, rotWidth);
+        long plane = side * side;
+
+        /* limit to 0-65535 */
+        for (int c = 0; c < 3; c++) {
+          for (long y = job->ry0; y < job->ry1; y++) {
+            const float *q = deferred ? ring + (c * ringRows + y % ringRows) * width : src + (c * width + y) * width;
+            float *p = rect + c * plane + (y - job->ry0) * side - job->rx0;
+            for (long x = job->rx0; x < job->rx1; x++) {
+              p[x] = MIN(MAX(q[x], 0.0f), 65535.0f);
+            }
+          }
+        }
+
+        switch (taps) {
+          case 2: rotate_tile<2>(rect, tile, width, job->rx0, job->ry0, side, ty, tyb, tx, txb, job->d0, job->s0, dr, sr, dd, ds, ur, uc, wr, wc); break;
+          case 4: rotate_tile<4>(rect, tile, width, job->rx0, job->ry0, side, ty, tyb, tx, txb, job->d0, job->s0, dr, sr, dd, ds, ur, uc, wr, wc); break;
+          default: rotate_tile<6>(rect, tile, width, job->rx0, job->ry0, side, ty, tyb, tx, txb, job->d0, job->s0, dr, sr, dd, ds, ur, uc, wr, wc);
+        }
+
+        for (long row = ty; row < tyb; row++) {
+          const float *t = tile + (row - ty) * ROTATE_TILE * 3;
+          ushort *q = dst + (row * rotWidth + tx) * 3;
+          for (long i = 0; i < (txb - tx) * 3; i++) {
+            q[i] = t[i];
+          }
+        }
+      }
+    }
+
+    delete[] rect;
+    delete[] tile;
+    delete[] scratch;
+  }
+
+  delete[] jobs;
+  delete[] first;
+  delete[] next;
+  delete[] order;
+  delete[] ring;
+  delete[] ur;
+  delete[] uc;
+  delete[] wr;
+  delete[] wc;
+}
+
 
 void run_ssdd (struct argp_state* state) {
   PARSE_ARGS_SSDD;
@@ -67,10 +399,9 @@ void run_ssdd (struct argp_state* state) {
   unsigned long cfaHeight;
   unsigned long width, height;
   float *frame0, *frame1, *frame2; // Bayer EXR frames or TCA-corrected R, G, B
-  float *data_in, *data_out, *data_rot;
-  float *out_ptr, *end_ptr;
+  float *data_in, *data_out;
   ushort *u_data_out;
-  bool landscape = false;
+  exr_orientation orient;
 
   if (args.interlaced_cfa) {
     printf("geometry: %s\n", args.geometry);
@@ -83,6 +414,7 @@ void run_ssdd (struct argp_state* state) {
       exit(EXIT_FAILURE);
     }
     width = height = cfaWidth + cfaHeight;
+    frame_orientation(&orient, args.orientation, cfaWidth, cfaHeight);
 
     start_time = clock();
     {
@@ -116,74 +448,22 @@ void run_ssdd (struct argp_state* state) {
         exit(EXIT_FAILURE);
       }
 
-      if (NULL == (data_in = (float *) malloc(sizeof(float) * width * width * 3))) {
+      if (NULL == (data_in = canvas_alloc(width, width, 3))) {
         fprintf(stderr, "allocation error. not enough memory?\n");
         exit(EXIT_FAILURE);
       }
-      if (NULL == (data_out = (float *) malloc(sizeof(float) * width * width * 3))) {
-        fprintf(stderr, "allocation error. not enough memory?\n");
-        exit(EXIT_FAILURE);
-      }
-
-      for (unsigned long i = 0; i < width * width * 3; i++) {
-        data_in[i] = 0;
-      }
     }
     end_time = clock();
     elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
     fprintf(stderr, "%6.3f seconds to allocate and zero-set memory\n", elapsed);
 
     start_time = clock();
-    for (unsigned long i = 0; i < (unsigned long)cfaWidth * cfaHeight; i++) {
-      if (cfaWidth > cfaHeight) {
-        // Landscape
-        //
-        // B........G
-        // ..........
-        // ..........
-        // G........R
-        //
-        landscape = true;
-        unsigned long x = i % cfaWidth + (unsigned long)(i / cfaWidth); // points to the first pixel in a pair
-        unsigned long y = (cfaWidth - i % cfaWidth - 1) + (i / cfaWidth);
-        unsigned long rix = y * width + x;
-        unsigned long gix = y * width + x + width * width;
-        unsigned long bix = y * width + x + width * width * 2;
-        // data_in[y * width + x] = frame0[i];
-        if (y % 2 == 0) {
-          data_in[gix] = frame1[gix];
-          data_in[gix + 1] = frame1[gix + 1];
-        }
-        else {
-          if ((x + y - 1) % 4 == 0 || (x + y - 1) % 4 == 1) {
-            data_in[rix] = frame0[rix];
-            data_in[rix + 1] = frame0[rix + 1];
-          }
-          else {
-            data_in[bix] = frame2[bix];
-            data_in[bix + 1] = frame2[bix + 1];
-          }
-        }
-      }
-      else {
-        // Portrait 270° CW
-        //
-        //  G.....R
-        //  .......
-        //  .......
-        //  .......
-        //  B.....G
-        //
-        unsigned long x0 = cfaHeight - 1 + i % cfaWidth - (unsigned long)(i / cfaWidth);
-        unsigned long x1 = x0 + 1; // the second frame (fn == 1) is shifted 1px to the right
-        unsigned long y = i % cfaWidth + (unsigned long)(i / cfaWidth);
-        data_in[y * width + x0] = frame0[i];
-        data_in[y * width + x1] = frame1[i];
-        data_in[y * width + x0 + width * width] = frame0[i];
-        data_in[y * width + x1 + width * width] = frame1[i];
-        data_in[y * width + x0 + width * width * 2] = frame0[i];
-        data_in[y * width + x1 + width * width * 2] = frame1[i];
-      }
+    {
+      // Each site of the diamond gets the plane of its color
+      exr_plane_pairs pairs = { { frame0, frame1, frame2 }, (long)width };
+      exr_merge(pairs, data_in, orient);
+      wxCopy(data_in, data_in + width * width, width * width);
+      wxCopy(data_in, data_in + 2 * width * width, width * width);
     }
     end_time = clock();
     elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
@@ -220,61 +500,25 @@ void run_ssdd (struct argp_state* state) {
       cfaWidth = nx0;
       cfaHeight = ny0;
       width = height = cfaWidth + cfaHeight;
-      landscape = cfaWidth > cfaHeight ? true : false;
+      frame_orientation(&orient, args.orientation, cfaWidth, cfaHeight);
 
-      if (NULL == (data_in = (float *) malloc(sizeof(float) * width * width * 3))) {
+      if (NULL == (data_in = canvas_alloc(width, width, 3))) {
         fprintf(stderr, "allocation error. not enough memory?\n");
         exit(EXIT_FAILURE);
       }
-
-      for (unsigned long i = 0; i < width * width * 3; i++) {
-        data_in[i] = 0;
-      }
     }
     end_time = clock();
     elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
     fprintf(stderr, "%6.3f seconds to allocate and zero-set memory\n", elapsed);
 
     start_time = clock();
-    for (unsigned long i = 0; i < (unsigned long)cfaWidth * cfaHeight; i++) {
-      if (cfaWidth > cfaHeight) {
-        // Landscape
-        //
-        // B........G
-        // ..........
-        // ..........
-        // G........R
-        //
-        landscape = true;
-        unsigned long x0 = i % cfaWidth + (unsigned long)(i / cfaWidth);
-        unsigned long x1 = x0 + 1; // the second frame (fn == 1) is shifted 1px to the right
-        unsigned long y = (cfaWidth - i % cfaWidth - 1) + (i / cfaWidth);
-        data_in[y * width + x0] = frame0[i];
-        data_in[y * width + x1] = frame1[i];
-        data_in[y * width + x0 + width * width] = frame0[i];
-        data_in[y * width + x1 + width * width] = frame1[i];
-        data_in[y * width + x0 + width * width * 2] = frame0[i];
-        data_in[y * width + x1 + width * width * 2] = frame1[i];
-      }
-      else {
-        // Portrait 270° CW
-        //
-        //  G.....R
-        //  .......
-        //  .......
-        //  .......
-        //  B.....G
-        //
-        unsigned long x0 = cfaHeight - 1 + i % cfaWidth - (unsigned long)(i / cfaWidth);
-        unsigned long x1 = x0 + 1; // the second frame (fn == 1) is shifted 1px to the right
-        unsigned long y = i % cfaWidth + (unsigned long)(i / cfaWidth);
-        data_in[y * width + x0] = frame0[i];
-        data_in[y * width + x1] = frame1[i];
-        data_in[y * width + x0 + width * width] = frame0[i];
-        data_in[y * width + x1 + width * width] = frame1[i];
-        data_in[y * width + x0 + width * width * 2] = frame0[i];
-        data_in[y * width + x1 + width * width * 2] = frame1[i];
-      }
+    {
+      // The raw sample goes to all three planes, to be replaced by the
+      // interpolation where it is not of their color
+      exr_frame_pairs<float> pairs = { frame0, frame1 };
+      exr_merge(pairs, data_in, orient);
+      wxCopy(data_in, data_in + width * width, width * width);
+      wxCopy(data_in, data_in + 2 * width * width, width * width);
     }
     end_time = clock();
     elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
@@ -284,17 +528,27 @@ void run_ssdd (struct argp_state* state) {
   } // Raw EXR Bayer frames
 
 
-  if (NULL == (data_out = (float *) malloc(sizeof(float) * width * width * 3))) {
+  // The stages of the chain go back and forth between data_in and data_out,
+  // so data_out is needed even if the last median is deferred
+  if (NULL == (data_out = canvas_alloc(width, width, 3))) {
     fprintf(stderr, "allocation error. not enough memory?\n");
     exit(EXIT_FAILURE);
   }
 
   start_time = clock();
-  unsigned char *mask = exr_cfa_mask(width, width, cfaWidth, cfaHeight);
+  unsigned char *mask = exr_cfa_mask(width, width, orient.ow, orient.oh);
   end_time = clock();
   elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
   fprintf(stderr, "%6.3f seconds to compute CFA mask\n", elapsed);
 
+  ssdd_options opts;
+  opts.nlm_graph_k = args.nlm_graph_k;
+  opts.green_only = args.green_only;
+  opts.chroma_radius = args.chroma_radius;
+  opts.half_chroma = args.half_chroma;
+  chroma_final final;
+  opts.final = &final; // the last median may be left to the rotation, band by band
+
   /* process */
   start_time = clock();
   ssdd_demosaic_chain (
@@ -306,25 +560,15 @@ void run_ssdd (struct argp_state* state) {
     data_out + 2 * width * width,
     (int) width,
     (int) width,
-    landscape ? cfaWidth : cfaHeight,
-    landscape ? cfaHeight : cfaWidth,
-    mask
+    orient.ow,
+    orient.oh,
+    mask,
+    &opts
   );
   end_time = clock();
   elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
   fprintf(stderr, "%6.3f seconds to complete debayering\n", elapsed);
 
-  /* limit to 0-65535 */
-  out_ptr = data_out;
-  end_ptr = out_ptr + 3 * width * width;
-  while (out_ptr < end_ptr) {
-    if ( 0 > *out_ptr)
-      *out_ptr = 0;
-    if ( 65535 < *out_ptr)
-      *out_ptr = 65535;
-    out_ptr++;
-  }
-
   // write_tiff_rgb_f32("result.tiff", data_out, width, width);
 
   // ---------------------------------------------------------------------------
@@ -332,89 +576,40 @@ void run_ssdd (struct argp_state* state) {
   //
   start_time = clock();
 
-  int i, row, col;
   double step = sqrt(0.5); // Horizontal or vertical CFA step projected onto
                            // source-plane axes
-  float r, c;              // Y- and X-coords in the source plane
-  unsigned ur, uc;         // Y- and X-coords of the nearest source pixel
-  float fr, fc;            // Y- and X-distance from (r, c) to nearest pixel
   ushort rotWidth, rotHeight;
 
-
-  // Inflated (√2) target image co-ordinates
+  // Inflated (√2) target image co-ordinates, in the orientation of the frames
   rotWidth = cfaWidth / step;
   rotHeight = (height - cfaWidth) / step;
 
-  if (NULL == (data_rot = (float *) malloc(sizeof(float) * rotWidth * rotHeight * 3))) {
+  // The deferred median reads the input planes of the chain
+  if (final.deferred) {
+    canvas_free(data_out, width);
+    data_out = NULL;
+  }
+
+  // Chunked, as written out
+  if (NULL == (u_data_out = (ushort *) malloc(sizeof(ushort) * rotWidth * rotHeight * 3))) {
     fprintf(stderr, "allocation error. not enough memory?\n");
     exit(EXIT_FAILURE);
   }
 
-  // Row and col are co-ordinates in the inflated target image.
-  for (row = 0; row < rotHeight; row++) {
-    for (col = 0; col < rotWidth; col++) {
-      // Reverse mapping: find co-ordinates (r, c) in the rotated
-      // CFA plane whose ushort casts (ur, uc) point to the source
-      // CFA pixel.
-      ur = r = cfaWidth + (row - col) * step;
-      uc = c = (row + col) * step;
-
-      // leave margins in the source image for the stencil
-      if (ur > (unsigned)(height - 2) || uc > (unsigned)(width - 2)) continue;
-
-      fr = r - ur;
-      fc = c - uc;
-
-      for (i = 0; i < 3; i++) { // for each color plane
-
-        // David Coffin's original stencil (chunked configuration)
-        //
-        //   pix = img + ur * iwidth + uc;
-        //   img[row * wide + col][i] =
-        //     (/* + */ pix[    0][i]*(1 - fc) + /* E  */ pix[        1][i] * fc) * (1 - fr) +
-        //     (/* S */ pix[width][i]*(1 - fc) + /* SE */ pix[width + 1][i] * fc) * fr;
-        //
-        // Same stencil reformulated for planar configuration
-        //
-        data_rot[row * rotWidth + col + i * rotWidth * rotHeight] =
-          (1 - fr) * (
-            (1 - fc) * data_out[ur * width + uc + i * width * height]              // +
-            +
-                  fc * data_out[ur * width + uc + i * width * height + 1]          // E
-          )
-          +
-          fr * (
-            (1 - fc) * data_out[ur * width + uc + i * width * height + width]      // S
-            +
-                  fc * data_out[ur * width + uc + i * width * height + width + 1]  // SE
-          )
-          ;
-      } // each color plane
-    }
-  }
+  rotate_exr(&final, data_out, u_data_out, width, rotWidth, rotHeight, orient, args.resample_taps);
   end_time = clock();
   elapsed = double(end_time - start_time) / CLOCKS_PER_SEC;
-  fprintf(stderr, "%6.3f seconds to rotate\n", elapsed);
+  if (final.deferred)
+    fprintf(stderr, "%6.3f seconds to run the last chromatic median and rotate\n", elapsed);
+  else
+    fprintf(stderr, "%6.3f seconds to rotate\n", elapsed);
+  chroma_final_free(&final);
 
 
   cerr << grey << "writing output to " << white << args.output_file << reset << endl;
   start_time = clock();
   {
     // Not using libtiff to write output because it creates invalid TIFF directories.
-
-    // Convert from planar to chunked
-    if (NULL == (u_data_out = (ushort *) malloc(sizeof(float) * rotWidth * rotHeight * 3))) {
-      cerr << on_red << "allocation error: not enough memory" << reset << endl;
-      exit(EXIT_FAILURE);
-    }
-    for (unsigned x = 0; x < rotWidth; x++) {
-      for (unsigned y = 0; y < rotHeight; y++) {
-        unsigned p = y * rotWidth + x;
-        u_data_out[y * 3 * rotWidth + x * 3] = data_rot[p];
-        u_data_out[y * 3 * rotWidth + x * 3 + 1] = data_rot[p + rotWidth * rotHeight];
-        u_data_out[y * 3 * rotWidth + x * 3 + 2] = data_rot[p + 2 * rotWidth * rotHeight];
-      }
-    }
     write_tiff_img(args.output_file, (unsigned char *)u_data_out, rotWidth, rotHeight, 16, 3, 0 /* chunked */);
   }
   end_time = clock();
@@ -422,9 +617,8 @@ void run_ssdd (struct argp_state* state) {
   cerr << yellow << setw(7) << setprecision(2) << elapsed << "s" << white << " writing" << reset << endl;
 
   delete[] mask;
-  free(data_in);
-  free(data_out);
-  free(data_rot);
+  canvas_free(data_in, width);
+  canvas_free(data_out, width);
   free(u_data_out);
 
   exit(EXIT_SUCCESS);
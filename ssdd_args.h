@@ -6,6 +6,12 @@
 struct arg_ssdd {
   bool interlaced_cfa;
   char* geometry;
+  int nlm_graph_k;
+  bool green_only;
+  float chroma_radius;
+  bool half_chroma;
+  int orientation;
+  int resample_taps;
   char* input_file_0;
   char* input_file_1;
   char* input_file_2;
@@ -36,7 +42,9 @@ static char doc_ssdd[] =
 "\n"
 "  1. The two input frames are rotated 45° CCW and merged\n"
 "     (interleaved) to reconstruct the high-resoluttion\n"
-"     EXR matrix.\n"
+"     EXR matrix. The frames are turned back to the\n"
+"     orientation of the sensor first, as given by -o (see\n"
+"     `exiftool -Orientation -n source.RAF`).\n"
 "\n"
 "  2. An algorithm analogous to Adams-Hamilton but with\n"
 "     EXR-specific stencils is used to do directional\n"
@@ -45,11 +53,26 @@ static char doc_ssdd[] =
 "\n"
 "  3. A non-local means filter is applied to each channel,\n"
 "     using the weighted average of the channel's raw values.\n"
+"     With -k, only the first of the three passes searches the\n"
+"     whole block; the following passes re-weight the K best\n"
+"     candidates it found for each channel.\n"
+"     With -g, only green is filtered, and red and blue are\n"
+"     interpolated again from the filtered green.\n"
 "\n"
 "  4. Chromatic noise is suppressed by a median filter.\n"
+"     From a radius of 3 set with -r, a histogram median\n"
+"     is used, whose cost does not grow with the radius; its\n"
+"     footprint is then a square of half-side round(R) rather\n"
+"     than a disc.\n"
+"     With -c, the chromatic components are filtered at half\n"
+"     resolution and upsampled with luminance as the guide.\n"
+"     R is then counted in half-resolution pixels, so the\n"
+"     footprint spans twice the radius in the image.\n"
 "\n"
 "  5. The interpolated image is rotated to restore its\n"
-"     photographic orientation.\n"
+"     photographic orientation, that of the input frames.\n"
+"     The image is resampled bilinearly, or with a bicubic or\n"
+"     Lanczos-3 kernel chosen with -s.\n"
 "\n"
 "Author: Gene Selkov\n"
 "\n"
@@ -75,6 +98,42 @@ static error_t parse_ssdd_command(int key, char* arg, struct argp_state* state)
       arguments->geometry = arg;
       break;
 
+    case 'g':
+      arguments->green_only = true;
+      break;
+
+    case 'c':
+      arguments->half_chroma = true;
+      break;
+
+    case 'r':
+      arguments->chroma_radius = atof(arg);
+      if (arguments->chroma_radius <= 0) {
+        argp_error(state, "The chroma median radius must be positive");
+      }
+      break;
+
+    case 'k':
+      arguments->nlm_graph_k = atoi(arg);
+      if (arguments->nlm_graph_k < 1) {
+        argp_error(state, "The number of cached NLM candidates must be positive");
+      }
+      break;
+
+    case 'o':
+      arguments->orientation = atoi(arg);
+      if (arguments->orientation != 1 and arguments->orientation != 3 and arguments->orientation != 6 and arguments->orientation != 8) {
+        argp_error(state, "Supported orientations are 1, 3, 6 and 8");
+      }
+      break;
+
+    case 's':
+      if (strcmp(arg, "bilinear") == 0) arguments->resample_taps = 2;
+      else if (strcmp(arg, "bicubic") == 0) arguments->resample_taps = 4;
+      else if (strcmp(arg, "lanczos3") == 0) arguments->resample_taps = 6;
+      else argp_error(state, "The resampling kernel must be bilinear, bicubic or lanczos3");
+      break;
+
     case ARGP_KEY_NO_ARGS:
       argp_usage (state);
 
@@ -106,10 +165,10 @@ static error_t parse_ssdd_command(int key, char* arg, struct argp_state* state)
         }
       }
       else {
-        if (state->arg_num < 2) {
+        if (state->arg_num < 3) {
           argp_error(state, "Not enough arguments");
         }
-        if (state->arg_num > 2) {
+        if (state->arg_num > 3) {
           argp_error(state, "Extra arguments");
         }
       }
@@ -126,6 +185,12 @@ static error_t parse_ssdd_command(int key, char* arg, struct argp_state* state)
 #pragma GCC diagnostic ignored "-Wmissing-field-initializers"
 static struct argp_option options_ssdd[] = {
   {"highres-exr", 'x', "WxH", 0, "Input is an interlaced high-resolution EXR array with the CFA geometry of WxH" },
+  {"nlm-graph", 'k', "K", 0, "Approximate NLM: after the first pass, re-weight only the K most similar candidates per channel" },
+  {"green-only", 'g', 0, 0, "Refine only green by NLM; rebuild red and blue from green by bilinear interpolation of color differences" },
+  {"chroma-radius", 'r', "R", 0, "Radius of the chromatic median filter (default 1.5)" },
+  {"half-chroma", 'c', 0, 0, "Run the chromatic median at half resolution, upsampled with luminance as the guide" },
+  {"orientation", 'o', "N", 0, "EXIF orientation of the frames: 1, 3, 6 or 8 (default 1 for landscape, 8 for portrait)" },
+  {"resample", 's', "KERNEL", 0, "Resampling kernel of the final rotation: bilinear (default), bicubic or lanczos3" },
   { 0 }
 };
 
@@ -146,6 +211,12 @@ static struct argp argp_ssdd = {
   if (!argv[0]) argp_failure(state, 1, ENOMEM, 0); \
   sprintf(argv[0], "%s ssdd", state->name); \
   args.interlaced_cfa = false; \
+  args.nlm_graph_k = 0; \
+  args.green_only = false; \
+  args.chroma_radius = 0; \
+  args.half_chroma = false; \
+  args.orientation = 0; \
+  args.resample_taps = 2; \
   argp_parse(&argp_ssdd, argc, argv, ARGP_IN_ORDER, &argc, &args); \
   free(argv[0]); \
   argv[0] = argv0; \
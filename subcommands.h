@@ -1,5 +1,7 @@
 // Entry points to tools
+void run_db (struct argp_state* state);
 void run_linear (struct argp_state* state);
+void run_merge (struct argp_state* state);
 void run_rotate (struct argp_state* state);
 void run_ssdd (struct argp_state* state);
 
@@ -79,37 +79,18 @@ unsigned char * deplanar(unsigned char* img, int nx, int ny, int bits, int frame
   return img;
 }
 
-int write_tiff_img (const char *fn, unsigned char *img, int nx, int ny, int bits, int frames, int isPlanar) {
-
-  int imgBytes = nx * ny * frames;
-
-  if (imgBytes < 1) return 1;
-
-  if (bits > 8) normalize16((uint16_t *) img, imgBytes);
-
-  if (bits > 8) imgBytes = 2 * imgBytes;
-
-  if (isLittleEndian() && (bits > 8)) img = swapImgBytes(img, imgBytes);
-
-  if (isPlanar) {
-    img = deplanar(img, nx, ny, bits, frames);
-  }
-
-  FILE* fptr = fopen(fn, "wb");
-  if (!fptr) return 1;
-
-  /* Write the header */
+static void write_header (FILE *fptr, int imgBytes) {
   WriteHexString(fptr,(char *)"4d4d002a");    /* Big endian & TIFF identifier */
   int offset = imgBytes + 8;
   putc((offset & 0xff000000) / 16777216, fptr);
   putc((offset & 0x00ff0000) / 65536, fptr);
   putc((offset & 0x0000ff00) / 256, fptr);
   putc((offset & 0x000000ff), fptr);
+}
 
-  /* Write the binary data */
-  fwrite(img, 1, imgBytes, fptr);
+static void write_footer (FILE *fptr, int nx, int ny, int bits, int frames, int imgBytes) {
+  int offset;
 
-  /* Write the footer */
   WriteHexString(fptr,(char *)"000e");  /* The number of directory entries (14) */
 
   /* Width tag, short int */
@@ -252,5 +233,125 @@ int write_tiff_img (const char *fn, unsigned char *img, int nx, int ny, int bits
       WriteHexString(fptr, (char *)"000100010001");
     }
   }
+} //end write_footer()
+
+int write_tiff_img (const char *fn, unsigned char *img, int nx, int ny, int bits, int frames, int isPlanar) {
+
+  int imgBytes = nx * ny * frames;
+
+  if (imgBytes < 1) return 1;
+
+  if (bits > 8) normalize16((uint16_t *) img, imgBytes);
+
+  if (bits > 8) imgBytes = 2 * imgBytes;
+
+  if (isLittleEndian() && (bits > 8)) img = swapImgBytes(img, imgBytes);
+
+  if (isPlanar) {
+    img = deplanar(img, nx, ny, bits, frames);
+  }
+
+  FILE* fptr = fopen(fn, "wb");
+  if (!fptr) return 1;
+
+  /* Write the header */
+  write_header(fptr, imgBytes);
+
+  /* Write the binary data */
+  fwrite(img, 1, imgBytes, fptr);
+
+  /* Write the footer */
+  write_footer(fptr, nx, ny, bits, frames, imgBytes);
+
+  fclose(fptr);
   return 0;
 } //end write_tiff_img()
+
+
+// Streaming version of write_tiff_img() for chunked images: the rows are
+// written as they come, and the directory after the last of them. The size
+// of the strip is known in advance, so the header can point to the
+// directory before the data.
+
+struct tiff_stream {
+  FILE *fptr;
+  int nx, ny, bits, frames;
+  int rowBytes;
+  int rows;       // rows written so far
+  int mx;         // maximum sample value so far
+};
+
+tiff_stream *write_tiff_open (const char *fn, int nx, int ny, int bits, int frames) {
+  if (nx < 1 or ny < 1 or frames < 1) return NULL;
+
+  tiff_stream *ts = (tiff_stream *)malloc(sizeof(tiff_stream));
+  if (!ts) return NULL;
+
+  // Read back by write_tiff_close() if the samples have to be normalized
+  if (!(ts->fptr = fopen(fn, "wb+"))) {
+    free(ts);
+    return NULL;
+  }
+  ts->nx = nx;
+  ts->ny = ny;
+  ts->bits = bits;
+  ts->frames = frames;
+  ts->rowBytes = nx * frames * (bits > 8 ? 2 : 1);
+  ts->rows = 0;
+  ts->mx = 0;
+
+  write_header(ts->fptr, ts->rowBytes * ny);
+  return ts;
+}
+
+int write_tiff_rows (tiff_stream *ts, unsigned char *img, int rows) {
+  if (ts->rows + rows > ts->ny) return 1;
+
+  int imgBytes = ts->rowBytes * rows;
+  if (ts->bits > 8) {
+    uint16_t *samples = (uint16_t *)img;
+    for (int i = 0; i < imgBytes / 2; i++)
+      if (samples[i] > ts->mx) ts->mx = samples[i];
+    if (isLittleEndian()) img = swapImgBytes(img, imgBytes);
+  }
+
+  if ((int)fwrite(img, 1, imgBytes, ts->fptr) != imgBytes) return 1;
+  ts->rows += rows;
+  return 0;
+}
+
+int write_tiff_close (tiff_stream *ts) {
+  int imgBytes = ts->rowBytes * ts->ny;
+  int status = ts->rows == ts->ny ? 0 : 1;
+
+  // The same scaling as normalize16(), now that the maximum is known: the
+  // data are read back and rewritten row by row.
+  if (status == 0 and ts->bits > 8 and ts->mx > 0 and 65535 / ts->mx > 1) {
+    int scale = 65535 / ts->mx;
+    unsigned char *row = (unsigned char *)malloc(ts->rowBytes);
+    if (!row) status = 1;
+    for (int y = 0; status == 0 and y < ts->ny; y++) {
+      long offset = 8 + (long)y * ts->rowBytes;
+      fseek(ts->fptr, offset, SEEK_SET);
+      if ((int)fread(row, 1, ts->rowBytes, ts->fptr) != ts->rowBytes) {
+        status = 1;
+        break;
+      }
+      for (int i = 0; i < ts->rowBytes; i += 2) {
+        int v = scale * ((row[i] << 8) | row[i + 1]); // big endian
+        row[i] = v >> 8;
+        row[i + 1] = v & 0xff;
+      }
+      fseek(ts->fptr, offset, SEEK_SET);
+      fwrite(row, 1, ts->rowBytes, ts->fptr);
+    }
+    free(row);
+    fseek(ts->fptr, 0, SEEK_END);
+  }
+
+  if (status == 0) write_footer(ts->fptr, ts->nx, ts->ny, ts->bits, ts->frames, imgBytes);
+
+  if (fclose(ts->fptr) != 0) status = 1;
+  free(ts);
+  return status;
+}
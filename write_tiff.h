@@ -13,6 +13,15 @@ extern "C" {
 
 int write_tiff_img (const char *fn, unsigned char *img, int nx, int ny, int bits, int frames, int isPlanar);
 
+// Write a chunked image a few rows at a time. 16-bit rows are in the host
+// byte order, and are swapped in place. The samples are normalized as by
+// write_tiff_img() when the file is closed.
+typedef struct tiff_stream tiff_stream;
+
+tiff_stream *write_tiff_open (const char *fn, int nx, int ny, int bits, int frames);
+int write_tiff_rows (tiff_stream *ts, unsigned char *img, int rows);
+int write_tiff_close (tiff_stream *ts);
+
 #ifdef  __cplusplus
 }
 #endif